@@ -18,6 +18,13 @@
 
 #include <string>
 #include <iostream> 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <sstream>
+#include <map>
 
 #include <SDL.h>
 #include "tclap/CmdLine.h"
@@ -26,6 +33,7 @@
 
 #include "CChunkyImage.h"
 #include "CAmigaImage.h"
+#include "CThreadPool.h"
 
 using namespace std;
 using namespace Magick;
@@ -51,8 +59,15 @@ void SdlError(const std::string& error,
 
 void DisplayPreview(const CChunkyImage& img, const int scale);
 
-vector<pair<int, int>> CombineImagesAndInitFactory(Image& imgCombined, CChunkyImageFactory& factory,
-                                                   const std::vector<string>& inputs, const int nbColors, const bool dithering);
+string SaveImage(CChunkyImage& img, const string& output, const string& format);
+
+Image LoadImage(const string& input, const string& size, const bool resizeFirst);
+
+string InitSharedFactory(CChunkyImageFactory& factory, vector<unique_ptr<Image>>& decodedImgs, const std::vector<string>& inputs,
+                         const std::function<Image(const string&)>& load, const size_t memoryBudget, const int nbColors, const bool dithering,
+                         const bool stats);
+
+string PaletteStats(const CColorHistogram& histogram, const CChunkyImageFactory& factory, const double milliseconds);
 
 
 
@@ -65,6 +80,8 @@ int main(int argc, char *argv[])
 {
     try
     {
+        InitializeMagick(*argv);
+
         //Parsing arguments
         TCLAP::CmdLine cmd{ "rgb2amiga - by Christophe Meneboeuf <christophe@xtof.info>", ' ', "1" };
         TCLAP::MultiArg<string> argInputs{ "i", "input", "Input file to process.", true, "string" };
@@ -72,69 +89,170 @@ int main(int argc, char *argv[])
         TCLAP::ValueArg<int>    argNbColors("c", "colors", "Number of colors to use. Defaults to \"32\".", false, 32, "string");
         TCLAP::ValueArg<string> argSize("s", "size", "Targeted size in WidthxHeight format. Defaults to \"320x256\"\n\tOptionnal suffix: '!' ignore the original aspect ratio. Only '!': keep input size", false, "320x256", "string");
         TCLAP::SwitchArg argDither("d", "dither", "Use dithering.");
+        TCLAP::ValueArg<string> argDitherMethod("", "dither-method", "Dithering algorithm: floyd-steinberg (default), sierra-lite, atkinson, bayer2x2, bayer4x4, bayer8x8, blue-noise, yliluoma or magick (ImageMagick's Floyd-Steinberg).", false, "floyd-steinberg", "method");
+        TCLAP::SwitchArg argRasterScan("", "raster-scan", "Diffuse the errors scanning all the rows from left to right, instead of alternating directions. The output differs from the default serpentine scan, but the threads can dither the same image.");
+        TCLAP::SwitchArg argResizeFirst("r", "resize-first", "Resize the images before reducing their colors instead of after. Faster and smoother on big images.");
         TCLAP::ValueArg<string> argFormat("f", "format", "Save as iff-ilbm (default) or png-gpl (PNG + Gimp palette).", false, "iff-ilbm", "format slection");
         TCLAP::ValueArg<int> argPreview("p", "preview", "Open a window to display a scaled preview. Defaults to no preview.", false, 0, "scale");
+        TCLAP::ValueArg<int> argJobs("j", "jobs", "Number of threads converting the images. 0: one per core. Defaults to 1.", false, 1, "number");
+        TCLAP::SwitchArg argPerImagePalette("", "per-image-palette", "Compute a palette for each image instead of sharing the same palette.");
+        TCLAP::ValueArg<int> argMemory("m", "memory", "Memory in MB to keep the images decoded between the shared palette and their conversion, instead of decoding them twice. Defaults to 0: each image is released once counted.", false, 0, "MB");
+        TCLAP::ValueArg<string> argQuantizer("q", "quantizer", "Palette selection: wu (default), in the Amiga colors, or magick (ImageMagick, then snapped to the Amiga colors).", false, "wu", "quantizer");
+        TCLAP::ValueArg<int> argRefine("", "refine", "Number of k-means iterations refining the palette. Defaults to 0: no refinement.", false, 0, "iterations");
+        TCLAP::ValueArg<int> argRefineTime("", "refine-time", "Time limit in milliseconds of the refinement of each palette. Defaults to 0: no limit.", false, 0, "ms");
+        TCLAP::ValueArg<int> argSeed("", "seed", "Seed of the refinement. The same seed gives the same palette. Defaults to 0.", false, 0, "number");
+        TCLAP::ValueArg<int> argSample("", "sample", "Compute the palette from a sample of this number of pixels of each image. Defaults to 0: all the pixels.", false, 0, "pixels");
+        TCLAP::ValueArg<double> argSampleError("", "sample-error", "Percentage by which the mean distance between the pixels of another sample and the palette may exceed the one of its own sample. Above, all the pixels are used. Defaults to 5.", false, 5.0, "percent");
+        TCLAP::ValueArg<string> argMetric("", "metric", "Distance between the colors: yuv (default), cielab or ciede2000.", false, "yuv", "metric");
+        TCLAP::SwitchArg argStats("", "stats", "Print the time spent computing the palette and the mean distance between the pixels and their palette color.");
         cmd.add(argInputs);
         cmd.add(argOutput);
         cmd.add(argNbColors);
         cmd.add(argSize);
         cmd.add(argDither);        
+        cmd.add(argDitherMethod);
+        cmd.add(argRasterScan);
+        cmd.add(argResizeFirst);
         cmd.add(argPreview);
         cmd.add(argFormat);
+        cmd.add(argJobs);
+        cmd.add(argPerImagePalette);
+        cmd.add(argMemory);
+        cmd.add(argQuantizer);
+        cmd.add(argRefine);
+        cmd.add(argRefineTime);
+        cmd.add(argSeed);
+        cmd.add(argSample);
+        cmd.add(argSampleError);
+        cmd.add(argMetric);
+        cmd.add(argStats);
         cmd.parse( argc, argv );
 
         if (argInputs.getValue().size() != argOutput.getValue().size()) {
           std::cerr << "Error: number of inputs and outputs must be the same" << std::endl;
           return 1;
         }
+        if (argFormat.getValue() != "iff-ilbm" && argFormat.getValue() != "png-gpl") {
+          std::cerr << "Error: format must be one of iff-ilbm or png-gpl" << std::endl;
+          return 1;
+        }
+        if (argJobs.getValue() < 0) {
+          std::cerr << "Error: number of jobs cannot be negative" << std::endl;
+          return 1;
+        }
+        if (argMemory.getValue() < 0) {
+          std::cerr << "Error: memory cannot be negative" << std::endl;
+          return 1;
+        }
+        if (argQuantizer.getValue() != "wu" && argQuantizer.getValue() != "magick") {
+          std::cerr << "Error: quantizer must be one of wu or magick" << std::endl;
+          return 1;
+        }
+        const std::map<string, CChunkyImageFactory::DitherMethod> ditherMethods = {
+          { "floyd-steinberg", CChunkyImageFactory::DitherMethod::FLOYD_STEINBERG },
+          { "sierra-lite", CChunkyImageFactory::DitherMethod::SIERRA_LITE },
+          { "atkinson", CChunkyImageFactory::DitherMethod::ATKINSON },
+          { "bayer2x2", CChunkyImageFactory::DitherMethod::BAYER_2X2 },
+          { "bayer4x4", CChunkyImageFactory::DitherMethod::BAYER_4X4 },
+          { "bayer8x8", CChunkyImageFactory::DitherMethod::BAYER_8X8 },
+          { "blue-noise", CChunkyImageFactory::DitherMethod::BLUE_NOISE },
+          { "yliluoma", CChunkyImageFactory::DitherMethod::MIXING_PLANS },
+          { "magick", CChunkyImageFactory::DitherMethod::MAGICK }
+        };
+        const auto ditherMethod = ditherMethods.find(argDitherMethod.getValue());
+        if (ditherMethod == ditherMethods.end()) {
+          std::cerr << "Error: dither method must be one of floyd-steinberg, sierra-lite, atkinson, bayer2x2, bayer4x4, bayer8x8, blue-noise, yliluoma or magick" << std::endl;
+          return 1;
+        }
+        if (argSample.getValue() < 0 || argSampleError.getValue() < 0.0) {
+          std::cerr << "Error: sample size and error cannot be negative" << std::endl;
+          return 1;
+        }
+        const std::map<string, CPalette::Metric> metrics = {
+          { "yuv", CPalette::Metric::YUV },
+          { "cielab", CPalette::Metric::CIELAB },
+          { "ciede2000", CPalette::Metric::CIEDE2000 }
+        };
+        const auto metric = metrics.find(argMetric.getValue());
+        if (metric == metrics.end()) {
+          std::cerr << "Error: metric must be one of yuv, cielab or ciede2000" << std::endl;
+          return 1;
+        }
+        const auto quantizer = argQuantizer.getValue() == "wu" ? CChunkyImageFactory::Quantizer::WU : CChunkyImageFactory::Quantizer::MAGICK;
+        if (argRefine.getValue() < 0 || argRefineTime.getValue() < 0) {
+          std::cerr << "Error: refinement iterations and time cannot be negative" << std::endl;
+          return 1;
+        }
+        const auto setUp = [&](CChunkyImageFactory& factory) {
+          factory.SetQuantizer(quantizer);
+          factory.SetMetric(metric->second);
+          factory.SetSampling(static_cast<uint64_t>(argSample.getValue()), argSampleError.getValue() / 100.0);
+          factory.SetDitherMethod(ditherMethod->second, !argRasterScan.getValue());
+          factory.SetRefinement(static_cast<unsigned>(argRefine.getValue()), static_cast<unsigned>(argRefineTime.getValue()),
+                                static_cast<uint32_t>(argSeed.getValue()));
+        };
+
+        CThreadPool::SetNbThreads(static_cast<unsigned>(argJobs.getValue()));
+        auto& threadPool = CThreadPool::GetInstance();
+        if (threadPool.GetNbThreads() > 1) {
+          // the images are processed in parallel: do not oversubscribe the cores with ImageMagick's own threads
+          MagickCore::SetMagickResourceLimit(MagickCore::ThreadResource, 1);
+        }
+
+        const auto& inputs = argInputs.getValue();
+        const auto& outputs = argOutput.getValue();
+        const auto& paletteSpace = CPaletteFactory::GetInstance().GetPalette("AMIGA");
+        vector<CChunkyImage> chunkyImgs(inputs.size());
+        vector<string> messages(inputs.size());
+        // when resizing first, the images are loaded at their final size
+        const auto load = [&](const string& input) { return LoadImage(input, argSize.getValue(), argResizeFirst.getValue()); };
+        const string convertSize = argResizeFirst.getValue() ? string("!") : argSize.getValue();
 
-        // 1st pass the images are "combined" in a canvas with a black background color
-        Image combinedImg(Geometry(0, 0), "black");
-        CChunkyImageFactory factory;
-        auto widthsHeights = CombineImagesAndInitFactory(combinedImg, factory, argInputs.getValue(), argNbColors.getValue(), argDither.getValue());
-        
-        if (factory.GetPalette().size() < argNbColors.getValue()) // the black color may not be present in the images and has wasted a color of the palette
+        if (argPerImagePalette.getValue())
         {
-          // 2nd pass the images are "combined" in a canvas with a color appearing in the final palette.
-          const auto& palette = factory.GetPalette();
-          Magick::Color canvasColor;
-          const auto& color = palette[0]; // black is not in the palette
-          constexpr int quantumSize = sizeof(MagickCore::Quantum);
-          canvasColor.redQuantum(color.r << (8 * (quantumSize - 1)));
-          canvasColor.greenQuantum(color.g << (8 * (quantumSize - 1)));
-          canvasColor.blueQuantum(color.b << (8 * (quantumSize - 1)));
-          combinedImg = Image(Geometry(0, 0), canvasColor);
-          widthsHeights = CombineImagesAndInitFactory(combinedImg, factory, argInputs.getValue(), argNbColors.getValue(), argDither.getValue());
+          // each image gets its own palette
+          threadPool.ParallelFor(inputs.size(), [&](const size_t i)
+          {
+            CChunkyImageFactory factory;
+            setUp(factory);
+            const Image img = load(inputs[i]);
+            const auto start = chrono::steady_clock::now();
+            factory.Init(img, argNbColors.getValue(), argDither.getValue(), paletteSpace);
+            const chrono::duration<double, milli> duration = chrono::steady_clock::now() - start;
+            chunkyImgs[i] = factory.GetImage(convertSize);
+            messages[i] = SaveImage(chunkyImgs[i], outputs[i], argFormat.getValue());
+            if (argStats.getValue()) {
+              CColorHistogram histogram;
+              histogram.Add(img);
+              messages[i] += PaletteStats(histogram, factory, duration.count());
+            }
+          });
         }
-
-        // split the color-reduced image into the separate output images
-        vector<CChunkyImage> chunkyImgs;
-        size_t vOffset = 0;
-        for (int i = 0; i < argInputs.getValue().size(); i++)
+        else
         {
-          CChunkyImage chunkyImg = factory.GetImage(Geometry(widthsHeights[i].first, widthsHeights[i].second, 0, vOffset), argSize.getValue());
-          chunkyImgs.push_back(chunkyImg);
-          vOffset += widthsHeights[i].second;
+          // the palette is computed from the colors of all the images, so they will all use the same
+          CChunkyImageFactory factory;
+          setUp(factory);
+          vector<unique_ptr<Image>> decodedImgs(inputs.size());
+          const auto memoryBudget = static_cast<size_t>(argMemory.getValue()) << 20;
+          std::cout << InitSharedFactory(factory, decodedImgs, inputs, load, memoryBudget, argNbColors.getValue(), argDither.getValue(), argStats.getValue());
+
+          threadPool.ParallelFor(inputs.size(), [&](const size_t i)
+          {
+            // only the images which did not fit in memory are decoded again
+            if (decodedImgs[i] == nullptr) {
+              decodedImgs[i].reset(new Image(load(inputs[i])));
+            }
+            chunkyImgs[i] = factory.GetImage(*decodedImgs[i], convertSize);
+            decodedImgs[i].reset();
+            messages[i] = SaveImage(chunkyImgs[i], outputs[i], argFormat.getValue());
+          });
         }
 
-        vector<CAmigaImage> amigaImgs;
-        for (int i = 0; i < chunkyImgs.size(); i++)
+        // report in the order of the inputs, whatever the order of completion
+        for (size_t i = 0; i < chunkyImgs.size(); i++)
         {
-          if (argFormat.getValue() == "iff-ilbm") {
-            CAmigaImage amigaImg;
-            amigaImg.Init(chunkyImgs[i]);
-            amigaImg.Save(argOutput.getValue()[i]);
-            std::cout << '\n' << argOutput.getValue()[i] << " saved." << '\n';
-          }
-          else if (argFormat.getValue() == "png-gpl") {
-            chunkyImgs[i].Save(argOutput.getValue()[i]+ ".png");
-            chunkyImgs[i].GetPalette().Save(argOutput.getValue()[i] + ".gpl");
-            std::cout << '\n' << argOutput.getValue()[i] << "{.png,.gpl} saved." << '\n';
-          }
-          else {
-            std::cerr << "Error: format must be one of iff-ilbm or png-gpl" << std::endl;
-            return 1;
-          }
+          std::cout << messages[i];
 
           // Display the preview if requested
           if (argPreview.getValue()) {
@@ -161,6 +279,20 @@ int main(int argc, char *argv[])
 }
 
 
+string SaveImage(CChunkyImage& img, const string& output, const string& format)
+{
+  if (format == "iff-ilbm") {
+    CAmigaImage amigaImg;
+    amigaImg.Init(img);
+    amigaImg.Save(output);
+    return '\n' + output + " saved.\n";
+  }
+  img.Save(output + ".png");
+  img.GetPalette().Save(output + ".gpl");
+  return '\n' + output + "{.png,.gpl} saved.\n";
+}
+
+
 void DisplayPreview(const CChunkyImage& img, const int scale)
 {
   
@@ -222,28 +354,95 @@ void DisplayPreview(const CChunkyImage& img, const int scale)
 
 
 
-vector<pair<int, int>> CombineImagesAndInitFactory(Image& imgCombined, CChunkyImageFactory& factory,
-                                                   const std::vector<string>& inputs, const int nbColors, const bool dithering)
+Image LoadImage(const string& input, const string& size, const bool resizeFirst)
 {
-  // Load all images into one big canvas
-  size_t vOffset = 0;
-  vector<pair<int, int>> widthsHeights;
-  for (auto inFile : inputs)
-  {
-    Image imgInput(inFile);
-    size_t imgW = imgInput.size().width();
-    size_t imgH = imgInput.size().height();
-    imgCombined.extent(Geometry(max(imgCombined.size().width(), imgW), imgCombined.size().height() + imgH), imgInput.backgroundColor());
-    imgCombined.copyPixels(imgInput, imgInput.size(), Offset(0, vOffset));
-    widthsHeights.push_back({ imgW, imgH });
-    vOffset += imgInput.size().height();
+  Image img = CChunkyImageFactory::Load(input, size);
+  if (resizeFirst) {
+    // the colors are not reduced yet: the image can be filtered
+    return CChunkyImageFactory::Resize(img, size, true);
   }
+  return img;
+}
 
 
+string InitSharedFactory(CChunkyImageFactory& factory, vector<unique_ptr<Image>>& decodedImgs, const std::vector<string>& inputs,
+                         const std::function<Image(const string&)>& load, const size_t memoryBudget, const int nbColors, const bool dithering,
+                         const bool stats)
+{
+  // The images are decoded once, in parallel. Their histograms are merged and
+  // they are kept decoded, for the conversion, as long as they fit in the budget.
+  // Only the pixels of the images are accounted: no padding color can waste an entry of the palette.
+  // When sampling, two samples are drawn from each image: one for the palette, one to check it.
+  const auto samplePixels = factory.GetSamplePixels();
+  CColorHistogram histogram, validation;
+  std::mutex histogramMutex;
+  std::atomic<size_t> memoryLeft{ memoryBudget };
+  CThreadPool::GetInstance().ParallelFor(inputs.size(), [&](const size_t i)
+  {
+    unique_ptr<Image> img(new Image(load(inputs[i])));
+    CColorHistogram imgHistogram, imgValidation;
+    if (samplePixels != 0) {
+      imgHistogram.AddSample(*img, samplePixels, static_cast<uint32_t>(2 * i));
+      imgValidation.AddSample(*img, samplePixels, static_cast<uint32_t>(2 * i + 1));
+    }
+    else {
+      imgHistogram.Add(*img);
+    }
+    {
+      std::lock_guard<std::mutex> lock(histogramMutex);
+      histogram.Merge(imgHistogram);
+      validation.Merge(imgValidation);
+    }
+
+    const size_t imgSize = img->size().width() * img->size().height() * sizeof(PixelPacket);
+    auto left = memoryLeft.load();
+    while (left >= imgSize && !memoryLeft.compare_exchange_weak(left, left - imgSize))
+    {    }
+    if (left >= imgSize) {
+      decodedImgs[i] = std::move(img);
+    }
+  });
 
-  // Get the palette from the combined images, so they will all use the same
+  // Get the palette from the combined histograms, so the images will all use the same
   CPalette palette = CPaletteFactory::GetInstance().GetPalette("AMIGA");
-  factory.Init(imgCombined, nbColors, dithering, palette);
+  const auto start = chrono::steady_clock::now();
+  if (samplePixels == 0 || !factory.InitSampled(histogram, validation, nbColors, dithering, palette))
+  {
+    if (samplePixels != 0) {
+      // the samples were not enough: all the pixels are counted
+      histogram = CColorHistogram{};
+      CThreadPool::GetInstance().ParallelFor(inputs.size(), [&](const size_t i)
+      {
+        CColorHistogram imgHistogram;
+        if (decodedImgs[i] != nullptr) {
+          imgHistogram.Add(*decodedImgs[i]);
+        }
+        else {
+          imgHistogram.Add(load(inputs[i]));
+        }
+        std::lock_guard<std::mutex> lock(histogramMutex);
+        histogram.Merge(imgHistogram);
+      });
+    }
+    factory.Init(histogram, nbColors, dithering, palette);
+  }
+  const chrono::duration<double, milli> duration = chrono::steady_clock::now() - start;
+  return stats ? PaletteStats(histogram, factory, duration.count()) : string{};
+}
+
 
-  return widthsHeights;
-}
\ No newline at end of file
+string PaletteStats(const CColorHistogram& histogram, const CChunkyImageFactory& factory, const double milliseconds)
+{
+  // the error is the mean distance between the pixels and their nearest color in the palette, in its metric
+  const auto& palette = factory.GetPalette();
+  std::ostringstream stats;
+  stats << "Palette: " << palette.size() << " colors computed in " << milliseconds << " ms, mean distance " << histogram.GetMeanError(palette);
+  if (factory.IsExact()) {
+    stats << " (already in Amiga colors: not quantized nor dithered)";
+  }
+  if (factory.IsSampled()) {
+    stats << " (computed from a sample)";
+  }
+  stats << '\n';
+  return stats.str();
+}
@@ -29,12 +29,15 @@ public:
     CAmigaImage();
     ~CAmigaImage(void);
 
+    /// @brief Sets up the conversion of the image, which has to outlive the call to Save()
     void Init(CChunkyImage&);
 
+    /// @brief Writes the image as a ByteRun1 compressed ILBM file
+    /// @details The image is converted, packed and written one scanline at a time,
+    ///          so that only a scanline of bitplanes is held in memory.
     void Save(const std::string & filepath);
 
 private:
-    static const unsigned int BITPLANE_DEPTH_MAX = 6;
     static const unsigned int OCS_COLORS_PER_CHANNEL = 4;
 
     struct
@@ -43,11 +46,9 @@ private:
         short height;
         unsigned int bitplaneDepth;
         int viewportMode;
-        uint8_t* bitplanes[BITPLANE_DEPTH_MAX];
     } _viewport;
     
     amiVideo_Screen* _screen = nullptr; //Screen conversion structure
-    uint8_t* _pBitplanes = nullptr;     //Memory to store bitplanes
     bool _isInitialized = false;
 };
 
@@ -21,6 +21,8 @@
 
 #include "CPalette.h"
 #include "CAmigaImage.h"
+#include "CColorHistogram.h"
+#include "CDitherer.h"
 
 #include <Magick++.h>
 
@@ -43,6 +45,7 @@ public:
 private:
     void Map() //Maps the colors of_image those of _palette
     {}
+    void FillRGB(); //Sets the pixels of _imageRGB to the colors of _imageIdx
 
     Magick::Image _imageRGB;
     std::vector< uint8_t > _imageIdx;
@@ -53,18 +56,120 @@ private:
 class CChunkyImageFactory
 {
 public:
+    /// @brief Algorithm selecting the colors of the palette
+    enum class Quantizer {
+        WU,         //Wu's quantizer, in the 12 bit OCS color space
+        MAGICK      //ImageMagick's quantize(), in 24 bit, the colors being snapped to the space afterwards
+    };
+
+    inline void SetQuantizer(const Quantizer quantizer) { _quantizer = quantizer; }
+
+    /// @brief Algorithm dithering the images, when dithering is enabled
+    enum class DitherMethod {
+        FLOYD_STEINBERG,
+        SIERRA_LITE,
+        ATKINSON,
+        BAYER_2X2,  //Ordered
+        BAYER_4X4,
+        BAYER_8X8,
+        BLUE_NOISE,
+        MIXING_PLANS, //Yliluoma's positional dithering, laid out by a 8x8 Bayer map
+        MAGICK      //ImageMagick's map(), before resizing the image
+    };
+
+    /// @brief Without serpentine scan, the error diffusion takes place in parallel, with another result than
+    ///        the serpentine scan.
+    ///        Ignored by the ordered methods.
+    /// @details Must be called before Init()
+    inline void SetDitherMethod(const DitherMethod method, const bool serpentine = true) {
+        _ditherMethod = method;
+        _serpentine = serpentine;
+    }
+
+    /// @brief Metric of the snapping of the colors to the space, and of the mapping of the undithered images
+    /// @details The native ditherers and the refinement keep comparing the colors in YUV.
+    inline void SetMetric(const CPalette::Metric metric) { _metric = metric; }
+
+    /// @brief Refines the palette with k-means iterations. 0 iterations (default) disables the refinement.
+    /// @details 0 milliseconds means no time limit. The same seed always gives the same palette, if not limited by the time.
+    inline void SetRefinement(const unsigned int iterations, const unsigned int milliseconds, const uint32_t seed) {
+        _refineIterations = iterations;
+        _refineMilliseconds = milliseconds;
+        _refineSeed = seed;
+    }
+
+    /// @brief Computes the palettes of the images bigger than maxPixels from samples of maxPixels pixels. 0 (default) disables it.
+    /// @details A palette computed from a sample is kept if its mean distance to the pixels of another sample,
+    ///          as CColorHistogram::GetMeanError(), does not exceed the one to the pixels of its own sample by more
+    ///          than maxError (0.05 for 5%). Otherwise, all the pixels are counted.
+    inline void SetSampling(const uint64_t maxPixels, const double maxError) {
+        _samplePixels = maxPixels;
+        _sampleMaxError = maxError;
+    }
+    inline uint64_t GetSamplePixels() const { return _samplePixels; }
+
+    /// @brief Computes the palette of one image
     void Init(const Magick::Image&, const unsigned int nbColors, const bool dither, const CPalette&);
-
-    inline CChunkyImage GetImage(const string& size) const { return GetImage(_imageRGB.size(), size); }
+    /// @brief Computes a palette shared by all the images accounted in the histogram
+    void Init(const CColorHistogram&, const unsigned int nbColors, const bool dither, const CPalette&);
+    /// @brief Computes a palette from a sample of the pixels, checked on a validation sample drawn separately
+    /// @details Returns false if the error bound is exceeded: the palette must then be computed from all the pixels.
+    bool InitSampled(const CColorHistogram& sample, const CColorHistogram& validation, const unsigned int nbColors,
+                     const bool dither, const CPalette&);
+
+    inline CChunkyImage GetImage(const string& size) const { return GetImage(_imageRGB, size); }
     inline const CPalette& GetPalette() const { return _palette; }
+    /// @brief True if the images were already made of no more colors of the space than requested
+    /// @details Their colors then are the palette: they are neither quantized nor dithered.
+    inline bool IsExact() const { return _exact; }
+    /// @brief True if the palette was computed from a sample of the pixels
+    inline bool IsSampled() const { return _sampled; }
+
+    /// @brief Maps the image to the palette and resizes it
+    CChunkyImage GetImage(const Magick::Image&, const string& size) const;
+
+    /// @brief Resizes the image to the size, in WidthxHeight format, keeping its width a multiple of 16
+    /// @details When filter is false, the image is sampled and no new color is introduced.
+    ///          "!" keeps the size of the image.
+    static Magick::Image Resize(const Magick::Image&, const string& size, const bool filter);
 
-    CChunkyImage GetImage(Magick::Geometry area, const string& size) const;
+    /// @brief Decodes an image file which will be resized to the size, in WidthxHeight format
+    /// @details Oversized images are reduced while loading, to SHRINK_ON_LOAD_MARGIN times the size:
+    ///          JPEG are decoded at a reduced scale, the other formats are box filtered once decoded.
+    static Magick::Image Load(const string& filename, const string& size);
 
 private:
-    Magick::Image _imageRGB;    
+    /// @brief Quantizes the histogram in 24 bit with ImageMagick and snaps the colors to the space
+    static CPalette QuantizeMagick(const CColorHistogram&, const unsigned int nbColors, const CPalette&);
+    /// @brief Index of the nearest OCS color, in the table of the 4096 colors
+    static inline unsigned int OcsKey(const rgba8Bits_t& color) {
+        return (((color.r + 8) / 17) << 8) | (((color.g + 8) / 17) << 4) | ((color.b + 8) / 17);
+    }
+    /// @brief Native ditherer of the dither method
+    CDitherer MakeDitherer(void) const;
+
+    Magick::Image _imageRGB;    //Image provided to Init, if any
+    Magick::Image _map;         //The palette as an image, to be used by Magick::Image::map()
     CPalette _palette;
+    bool _dither = false;
+    bool _exact = false;        //The colors of the images are the palette
+    bool _sampled = false;      //The palette was computed from a sample
+    uint64_t _samplePixels = 0;
+    double _sampleMaxError = 0.05;
+    Quantizer _quantizer = Quantizer::WU;
+    CPalette::Metric _metric = CPalette::Metric::YUV;
+    DitherMethod _ditherMethod = DitherMethod::FLOYD_STEINBERG;
+    bool _serpentine = true;
+    std::shared_ptr<const CDitherer> _ditherer;   //Shared by the images, if dithered natively
+    std::vector<int16_t> _ocsIndices;   //Index in the palette of each OCS color, by OcsKey(), or -1
+    unsigned int _refineIterations = 0;
+    unsigned int _refineMilliseconds = 0;
+    uint32_t _refineSeed = 0;
 
     static const unsigned int OCS_MAX_COLORS = 32;
+    static const uint32_t SAMPLE_SEED = 0;
+    static const uint64_t QUANTIZE_MAX_PIXELS = 1u << 20;
+    static const unsigned int SHRINK_ON_LOAD_MARGIN = 2;
 };
 
 
@@ -0,0 +1,87 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CCOLORHISTOGRAM_H
+#define CCOLORHISTOGRAM_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CPalette.h"
+
+
+/******************************/
+/*   CLASS CCOLORHISTOGRAM    */
+/******************************/
+/// @brief Number of pixels of each 8 bit color found in one or several images
+/// @details Used to compute a palette shared by several images without having
+///          to keep them all in memory. The counts are kept sorted by color.
+///          An image is counted by tiles of rows, in parallel: the tiles of OCS colors
+///          in a table of the 4096 colors, the others by radix sorting their colors.
+///          The counts of the tiles are then merged.
+class CColorHistogram
+{
+public:
+    void Add(const Magick::Image&);             //Counts the pixels of the image
+    void Merge(const CColorHistogram&);         //Adds the counts of another histogram
+
+    /// @brief Counts about maxPixels pixels of the image, one drawn in each cell of a regular grid
+    /// @details The same seed draws the same pixels. Images smaller than maxPixels are fully counted.
+    void AddSample(const Magick::Image&, const uint64_t maxPixels, const uint32_t seed);
+
+    /// @brief Sets colors and counts to the colors of the histogram and their number of pixels
+    void GetColors(std::vector<rgba8Bits_t>& colors, std::vector<uint64_t>& counts) const;
+
+    inline std::size_t GetNbColors(void) const { return _counts.size(); }
+    inline uint64_t GetNbPixels(void) const { return _nbPixels; }
+
+    /// @brief Calls fct(color, count) for each color of the histogram, by increasing rgba8Bits_t::Hash()
+    template<typename F>
+    void ForEach(F fct) const
+    {
+        for (const auto& count : _counts) {
+            fct(count.first, count.second);
+        }
+    }
+
+    /// @brief Mean distance between the pixels and their nearest color in the palette, in its metric
+    /// @details The distance itself, not its square: in the units of the coordinates of the metric.
+    double GetMeanError(const CPalette&) const;
+
+    /// @brief Returns a one row image containing the colors of the histogram
+    /// @details Each color is repeated proportionally to its count, the image holding
+    ///          about maxPixels pixels or at least one pixel per color.
+    Magick::Image GetImage(const uint64_t maxPixels) const;
+
+private:
+    typedef std::vector<std::pair<unsigned int, uint64_t>> Counts; //count by rgba8Bits_t::Hash(), sorted
+
+    static const std::size_t TILE_PIXELS = 1u << 16;    //Pixels counted by a thread at once
+
+    /// @brief Sets counts to the counts of the colors of the pixels
+    static void CountTile(const PixelPacket* pixels, const std::size_t nbPixels, Counts& counts);
+    /// @brief Sets merged to the sum of the counts
+    static void MergeCounts(const Counts& counts1, const Counts& counts2, Counts& merged);
+
+    Counts _counts;
+    uint64_t _nbPixels = 0;
+};
+
+#endif // CCOLORHISTOGRAM_H
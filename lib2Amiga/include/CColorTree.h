@@ -0,0 +1,70 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CCOLORTREE_H
+#define CCOLORTREE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CPalette.h"
+
+
+/******************************/
+/*      CLASS CCOLORTREE      */
+/******************************/
+/// @brief k-d tree over the colors of a palette, in the coordinates of a Euclidean metric
+/// @details Each node splits its colors at the median of the axis where they spread the most.
+///          The distances to the colors of the leaves are the ones of CPalette::Distance(),
+///          and a node is skipped only if all its colors are strictly farther than the nearest
+///          one found: the result is the one of a linear search, the first color winning the ties.
+class CColorTree
+{
+public:
+    /// @brief The metric is YUV or CIELAB
+    CColorTree(const std::vector<rgba8Bits_t>& colors, const CPalette::Metric metric);
+
+    /// @brief Index of the color nearest to color. The tree must not be empty.
+    std::size_t GetNearestIndex(const rgba8Bits_t& color) const;
+
+private:
+    static const std::size_t LEAF_SIZE = 8; //Maximum number of colors of a leaf
+
+    struct Point
+    {
+        double coords[3];   //Coordinates in the space of the metric
+        uint32_t index;     //Index in the palette
+    };
+    struct Node
+    {
+        uint32_t begin;     //Points of the node
+        uint32_t end;
+        int axis;           //-1 for a leaf
+        double split;       //Points before the middle are <= split, the others >= split
+        uint32_t children;  //Index of the lower child, followed by the upper one
+    };
+
+    void Build(const uint32_t node, const uint32_t begin, const uint32_t end);
+    void Search(const uint32_t node, const double* coords, double& nearest, std::size_t& found) const;
+
+    CPalette::Metric _metric;
+    std::vector<Point> _points;
+    std::vector<Node> _nodes;
+};
+
+#endif // CCOLORTREE_H
@@ -0,0 +1,152 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CDITHERER_H
+#define CDITHERER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CPalette.h"
+
+
+/******************************/
+/*      CLASS CDITHERER       */
+/******************************/
+/// @brief Error diffusion or ordered dithering of an image to the indices of a palette
+/// @details Error diffusion: the image is processed row by row in 8 bit RGB. The errors are kept in
+///          int16 with ERROR_BITS fractional bits, in rows of (r, g, b, 0) quadruplets,
+///          so that one pixel's error is propagated to a neighbour in one SIMD operation.
+///          Without serpentine scan, the rows are dithered in parallel, as a wavefront, by
+///          the threads of CThreadPool: the indices are the same whatever the number of threads.
+///          A serpentine scan is dithered by one thread, as a row starts where the row above
+///          ends and needs all its errors.
+///          Ordered: each pixel is offset by the threshold of its position in a tiled map and
+///          mapped on its own, BLOCK pixels at a time, the rows being shared by the threads.
+///          Mixing plans: each color is rendered by a plan of palette colors whose mean is the
+///          nearest to the color, laid out by the map (Yliluoma's positional dithering). The plans
+///          are cached by 15 bit color, computed by the first thread needing them.
+class CDitherer
+{
+public:
+    struct Tap
+    {
+        int dx;         //Column offset, in the direction of the scan
+        int dy;         //Row offset
+        int16_t weight; //Weight of the error, divided by 2^shift
+    };
+    struct Kernel
+    {
+        static const unsigned int MAX_TAPS = 6;
+        Tap taps[MAX_TAPS];
+        unsigned int nbTaps;
+        int shift;
+    };
+
+    static const Kernel FLOYD_STEINBERG;
+    static const Kernel SIERRA_LITE;
+    static const Kernel ATKINSON;
+
+    struct ThresholdMap
+    {
+        unsigned int size;          //The map is size x size
+        const uint8_t* thresholds;  //Ranks, from 0 to size x size - 1
+    };
+
+    static const ThresholdMap BAYER_2X2;
+    static const ThresholdMap BAYER_4X4;
+    static const ThresholdMap BAYER_8X8;
+    static const ThresholdMap BLUE_NOISE;  //16x16 void-and-cluster tile
+
+    /// @brief Error diffusion. When serpentine, the odd rows are scanned from right to left.
+    CDitherer(const CPalette& palette, const Kernel& kernel, const bool serpentine = true);
+    /// @brief Ordered dithering, or positional dithering with mixing plans of size x size colors
+    /// @details The copies of a mixing plan ditherer share the cache of the plans.
+    CDitherer(const CPalette& palette, const ThresholdMap& thresholds, const bool mixingPlans = false);
+
+    /// @brief Sets indices to the dithered pixels of the image, as indices of the palette
+    void Dither(const Magick::Image& image, std::vector<uint8_t>& indices) const;
+
+private:
+    static const int ERROR_BITS = 4;
+    static const int MAX_DY = 2;    //Error rows kept: the current one and MAX_DY below
+    static const int PADDING = 2;   //Columns on each side absorbing the errors out of the image
+    static const std::size_t BLOCK = 8; //Pixels mapped together by the ordered dithering
+
+    explicit CDitherer(const CPalette& palette);
+
+    /// @brief 8 bit RGB pixels of the image
+    static std::vector<uint8_t> GetRGB(const Magick::Image& image);
+
+    void DitherOrdered(const Magick::Image& image, std::vector<uint8_t>& indices) const;
+    void DitherMixingPlans(const Magick::Image& image, std::vector<uint8_t>& indices) const;
+
+    /// @brief Returns the mixing plan of the 15 bit color, computing it if not cached yet
+    const uint8_t* GetPlan(const unsigned int key) const;
+    /// @brief Sets plan to the mixing plan of the color, sorted by luma
+    void ComputePlan(const rgba8Bits_t& color, uint8_t* plan) const;
+
+    /// @brief Rows dithered in parallel, where a thread falls asleep when the row above is late
+    struct Wavefront
+    {
+        std::vector<std::atomic<std::size_t>> progress;  //Pixels done in each row
+        std::atomic<unsigned int> sleepers{ 0 };
+        std::mutex mutex;
+        std::condition_variable progressed;
+    };
+
+    /// @brief Dithers the row y of the rgb pixels, errors being a rolling buffer of nbRows error rows
+    /// @details If a wavefront is provided, waits for the row above to progress before each pixel
+    ///          and updates the progress of the row y.
+    void DitherRow(const std::size_t y, const std::size_t width, const uint8_t* rgb, uint8_t* indices,
+                   int16_t* errors, const std::size_t stride, const std::size_t nbRows, Wavefront* wavefront) const;
+
+    /// @brief Index of the palette color nearest to the 8 bit color
+    uint8_t GetNearestIndex(const int r, const int g, const int b) const;
+    /// @brief Sets indices to the indices of the palette colors nearest to BLOCK RGB colors
+    void GetNearestIndices(const float* r, const float* g, const float* b, uint8_t* indices) const;
+
+    CPalette _palette;
+    Kernel _kernel;
+    bool _serpentine = true;
+    std::size_t _lag = 1;   //Pixels of the row above to be done before a pixel can be dithered
+    ThresholdMap _thresholds;
+    float _spread = 0.0f;   //Range of the offsets of the ordered dithering
+
+    static const unsigned int MAX_SPINS = 64;       //Yields before a waiting thread falls asleep
+    static const unsigned int PLAN_KEY_BITS = 5;    //Bits per channel of the colors of the cached plans
+    enum PlanState : uint8_t { PLAN_EMPTY, PLAN_BUSY, PLAN_READY };
+    struct PlanCache
+    {
+        std::vector<std::atomic<uint8_t>> states;   //PlanState of each color
+        std::vector<uint8_t> plans;
+        std::mutex mutex;
+        std::condition_variable ready;  //Signalled when a plan is ready
+    };
+    std::shared_ptr<PlanCache> _plans;  //Only for the mixing plans
+    std::vector<float> _y;  //YUV of the palette, padded with far away colors
+    std::vector<float> _u;
+    std::vector<float> _v;
+};
+
+#endif // CDITHERER_H
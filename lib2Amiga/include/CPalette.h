@@ -21,7 +21,10 @@
 #define CPALETTE_H
 
 #include <limits>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -32,6 +35,8 @@
 using namespace Magick;
 using namespace std;
 
+class CColorTree;
+
 
 
 //MUST BE BIT EXACT BITH "amiVideo_Color"
@@ -101,19 +106,116 @@ struct rgba8Bits_t
 /******************************/
 /*       CLASS CPALETTE       */
 /******************************/
+/// @details The colors are read as a std::vector. They are only changed through CPalette,
+///          which hides the write access of std::vector: each change takes a new stamp,
+///          telling the nearest color searches to rebuild their structure.
 class CPalette : public std::vector<rgba8Bits_t>
 {
+    using Colors = std::vector<rgba8Bits_t>;
 public:
     CPalette( void )
     {}
     CPalette(const unordered_map < unsigned int, rgba8Bits_t >& colors);
     CPalette(const std::vector<rgba8Bits_t >& colors);
+    /// @brief The search structure is shared with the copy. It is read atomically,
+    ///        as it may be rebuilt at the same time by a search in another thread.
+    CPalette(const CPalette& other);
+    CPalette(CPalette&& other) = default;
+    CPalette& operator=(const CPalette& other);
+    CPalette& operator=(CPalette&& other) = default;
+
+    inline const rgba8Bits_t& operator[](const size_type i) const { return Colors::operator[](i); }
+    inline const rgba8Bits_t& at(const size_type i) const { return Colors::at(i); }
+    inline const rgba8Bits_t& front(void) const { return Colors::front(); }
+    inline const rgba8Bits_t& back(void) const { return Colors::back(); }
+    inline const rgba8Bits_t* data(void) const { return Colors::data(); }
+    inline const_iterator begin(void) const { return Colors::begin(); }
+    inline const_iterator end(void) const { return Colors::end(); }
+    inline const_reverse_iterator rbegin(void) const { return Colors::rbegin(); }
+    inline const_reverse_iterator rend(void) const { return Colors::rend(); }
+
+    inline void push_back(const rgba8Bits_t& color) { Colors::push_back(color); _stamp = NewStamp(); }
+    inline void clear(void) { Colors::clear(); _stamp = NewStamp(); }
 
     void Save(const string& filename) const;
 
-    rgba8Bits_t GetNearestColor(const rgba8Bits_t& color) const; //Returns the nearest color in the palette 
-    
+    /// @brief Metric of the distances between colors, used by the nearest color searches
+    enum class Metric {
+        YUV,        //Euclidean in YUV, as rgba8Bits_t::Distance()
+        CIELAB,     //Euclidean in CIELAB (CIE76)
+        CIEDE2000   //CIEDE2000, in CIELAB
+    };
+
+    inline void SetMetric(const Metric metric) { _metric = metric; }
+    inline Metric GetMetric(void) const { return _metric; }
+
+    /// @brief Squared distance between two colors, in the metric of the palette
+    double Distance(const rgba8Bits_t& color1, const rgba8Bits_t& color2) const;
+    /// @brief Sets coords to the coordinates of the color in YUV, or in CIELAB for the two CIE metrics
+    /// @details The CIELAB coordinates of the 4096 OCS colors are precomputed. The other colors are
+    ///          linearized through a table of the 256 sRGB levels.
+    static void GetCoordinates(const Metric metric, const rgba8Bits_t& color, double* coords);
+
+    /// @brief Returns the nearest color in the palette, or its index
+    /// @details The search structure is rebuilt only if the colors or the metric changed since the
+    ///          last search. Many colors are best searched by SearchNearestIndices(), in parallel.
+    rgba8Bits_t GetNearestColor(const rgba8Bits_t& color) const;
+    std::size_t GetNearestIndex(const rgba8Bits_t& color) const;
+
+    /// @brief Sets indices to the indices of the palette colors nearest to the colors, as GetNearestIndex()
+    /// @details Below TREE_MIN_COLORS colors, the distances are first computed in float, LANES palette
+    ///          colors at a time, from a copy of the palette coordinates. Only the colors within the float
+    ///          rounding of the nearest are then compared in double. Bigger palettes, as the color spaces,
+    ///          are searched in a CColorTree. The result is exact. CIEDE2000 not being Euclidean, its
+    ///          distances are all computed, from the precomputed CIELAB of the palette.
+    void SearchNearestIndices(const rgba8Bits_t* colors, const std::size_t count, uint32_t* indices) const;
+
+    /// @brief Sets indices to the indices of the palette colors nearest to the colors
+    /// @details Looked up in an inverse colormap of 18 bit colors, filled when first needed, in parallel
+    ///          for big batches. The colors are approximated to 6 bits per channel.
+    void GetNearestIndices(const rgba8Bits_t* colors, const std::size_t count, uint16_t* indices) const;
+    inline void GetNearestIndices(const std::vector<rgba8Bits_t>& colors, std::vector<uint16_t>& indices) const {
+        indices.resize(colors.size());
+        GetNearestIndices(colors.data(), colors.size(), indices.data());
+    }
+
 private:
+    static const unsigned int INVERSE_BITS = 6; //Bits per channel of the inverse colormap
+    static const uint16_t INVERSE_EMPTY = 0xFFFF;
+    static const std::size_t LANES = 8;         //Palette colors compared together
+    static const std::size_t TREE_MIN_COLORS = 512;     //Size from which a palette is searched in a tree
+    struct Search
+    {
+        Metric metric;                      //The metric and the stamp of the colors the structure was built for
+        uint64_t stamp;
+        std::vector<double> coords;         //Coordinates of the colors, 3 by color
+        std::vector<float> x;               //The coordinates in float, padded with far away colors
+        std::vector<float> y;
+        std::vector<float> z;
+        std::unique_ptr<CColorTree> tree;   //Instead of the coordinates, for the big palettes
+        std::once_flag inverseFlag;
+        std::unique_ptr<std::atomic<uint16_t>[]> inverse;   //Inverse colormap, allocated when first needed
+    };
+    mutable std::shared_ptr<Search> _search; //Shared by the copies, rebuilt if the colors change
+
+    /// @brief A stamp never taken before, by any palette
+    static uint64_t NewStamp(void);
+
+    using Colors::emplace_back;
+    using Colors::pop_back;
+    using Colors::insert;
+    using Colors::erase;
+    using Colors::resize;
+    using Colors::assign;
+    using Colors::swap;
+    uint64_t _stamp = NewStamp();   //Of the current colors
+
+    std::shared_ptr<Search> GetSearch(void) const;
+    /// @brief Index of the color nearest to color. distances is a scratch buffer of x.size() floats.
+    std::size_t SearchNearestIndex(const Search& search, const rgba8Bits_t& color, float* distances) const;
+
+    Metric _metric = Metric::YUV;
+
 
   /// @brief Sorting colors in palette to help editing width Deluxe Paint
   ///  @details PLUS: having black as colors 0 appears to help color fidelity on the *real* hardware
@@ -0,0 +1,63 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CPALETTEREFINER_H
+#define CPALETTEREFINER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CPalette.h"
+#include "CColorHistogram.h"
+
+
+/******************************/
+/*   CLASS CPALETTEREFINER    */
+/******************************/
+/// @brief Refines a palette with k-means iterations over the colors of a histogram
+/// @details The colors are assigned to their nearest centroid in YUV, as rgba8Bits_t::Distance(),
+///          then each centroid moves to the weighted mean of its colors, snapped to the space.
+///          The sums are integers, so that the result does not depend on the order of the
+///          accumulation: it is the same for a given seed, whatever the number of threads.
+class CPaletteRefiner
+{
+public:
+    explicit CPaletteRefiner(const CColorHistogram& histogram);
+
+    /// @brief Returns the refined palette
+    /// @details Stops when the centroids do not move anymore, after maxIterations or when
+    ///          maxMilliseconds are elapsed, if not 0. Empty clusters are reseeded from the seed.
+    ///          Throws a CError if the palette has more than MAX_COLORS colors.
+    CPalette Refine(const CPalette& palette, const CPalette& space, const unsigned int maxIterations,
+                    const unsigned int maxMilliseconds, const uint32_t seed) const;
+
+private:
+    static const std::size_t BLOCK = 8; // points processed together by the assignment kernel
+    static const std::size_t MAX_COLORS = 1u << 16; // colors of the palette, indexed by uint16_t clusters
+
+    /// @brief Sets clusters[i] to the index of the centroid nearest to the point i, for i in [begin, end[
+    void Assign(const std::vector<float>& centroidsY, const std::vector<float>& centroidsU, const std::vector<float>& centroidsV,
+                const std::size_t begin, const std::size_t end, uint16_t* clusters) const;
+
+    std::vector<rgba8Bits_t> _colors;
+    std::vector<uint64_t> _weights;
+    std::vector<float> _y;  //YUV of the colors, padded to a multiple of BLOCK
+    std::vector<float> _u;
+    std::vector<float> _v;
+};
+
+#endif // CPALETTEREFINER_H
@@ -0,0 +1,72 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CQUANTIZER_H
+#define CQUANTIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "CPalette.h"
+#include "CColorHistogram.h"
+
+
+/******************************/
+/*      CLASS CQUANTIZER      */
+/******************************/
+/// @brief Wu's color quantizer working directly in the 12 bit OCS color space
+/// @details The histogram is reduced to the 16x16x16 grid of the OCS colors: the
+///          boxes are split along this grid, so the colors found are the best
+///          for the Amiga, without any further 24 bit pass on the image.
+class CQuantizer
+{
+public:
+    /// @brief Returns at most nbColors colors of the space representing the histogram
+    static CPalette Quantize(const CColorHistogram& histogram, const unsigned int nbColors, const CPalette& space);
+
+private:
+    static const int SIDE = 17; // 16 levels per channel, plus a zero border for the cumulative moments
+
+    struct Box
+    {
+        int r0, r1; // r0 excluded, r1 included
+        int g0, g1;
+        int b0, b1;
+        int volume;
+    };
+    enum Direction { RED, GREEN, BLUE };
+    using Moments = std::vector<int64_t>;
+
+    CQuantizer(const CColorHistogram& histogram);
+
+    static inline int Index(const int r, const int g, const int b) { return (r * SIDE + g) * SIDE + b; }
+    static int64_t Volume(const Box&, const Moments&);
+    static int64_t Bottom(const Box&, const Direction, const Moments&);
+    static int64_t Top(const Box&, const Direction, const int position, const Moments&);
+    double Variance(const Box&) const;
+    double Maximize(const Box&, const Direction, const int first, const int last, int& cut,
+                    const int64_t wholeR, const int64_t wholeG, const int64_t wholeB, const int64_t wholeW) const;
+    bool Cut(Box& box1, Box& box2) const;
+
+    Moments _weights;
+    Moments _momentsR;
+    Moments _momentsG;
+    Moments _momentsB;
+    std::vector<double> _moments2;
+};
+
+#endif // CQUANTIZER_H
@@ -0,0 +1,92 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CTHREADPOOL_H
+#define CTHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/******************************/
+/*     CLASS CTHREADPOOL      */
+/******************************/
+/// @brief Work-stealing thread pool
+/// @details Each worker owns a task queue: it pops its own tasks LIFO and steals
+///          the oldest tasks of the other workers when it runs dry, so that big and
+///          small jobs balance across the cores.
+///          The thread calling ParallelFor() takes part in the work while waiting,
+///          thus ParallelFor() can safely be nested inside a task.
+class CThreadPool
+{
+public:
+    static CThreadPool& GetInstance(void)
+    {
+        if (_Instance == nullptr) {
+            _Instance = new CThreadPool(_NbThreads);
+        }
+        return *_Instance;
+    }
+
+    /// @brief Sets the number of threads used by the instance. 0 means "one per core".
+    /// @details An existing instance is destroyed, the next call to GetInstance() creating
+    ///          one of the new size: no task must be running.
+    static void SetNbThreads(const unsigned int nbThreads);
+
+    explicit CThreadPool(const unsigned int nbThreads);
+    ~CThreadPool();
+    CThreadPool(const CThreadPool&) = delete;
+    CThreadPool& operator=(const CThreadPool&) = delete;
+
+    /// @brief Number of threads working, including the calling one
+    inline unsigned int GetNbThreads(void) const { return static_cast<unsigned int>(_workers.size()) + 1u; }
+
+    /// @brief Calls fct(i) for each i in [0, count[ and returns when all the calls are done.
+    /// @details If some calls throw, the exception thrown by the lowest index is rethrown.
+    void ParallelFor(const std::size_t count, const std::function<void(std::size_t)>& fct);
+
+private:
+    using Task = std::function<void(void)>;
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Push(Task task);
+    bool TryRunOne(const std::size_t queueIdx);
+    std::size_t GetQueueIndex(void);
+    void WorkerLoop(const std::size_t queueIdx);
+
+    std::vector<std::unique_ptr<Queue>> _queues; // one per worker, the last one for the other threads
+    std::vector<std::thread> _workers;
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeUp;
+    std::atomic<std::size_t> _pending{ 0 };
+    bool _stop = false;
+
+    static CThreadPool* _Instance;
+    static unsigned int _NbThreads;
+};
+
+#endif // CTHREADPOOL_H
@@ -15,13 +15,15 @@
 *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <vector>
+
 #include "libamivideo/amivideotypes.h"
 #include "libamivideo/viewportmode.h"
 #include "libamivideo/screen.h"
 #include "libilbm/ilbmimage.h"
 #include "libilbm/bitmapheader.h"
-#include "libilbm/interleave.h"
 #include "libilbm/ilbm.h"
+#include "libilbm/ilbmwriter.h"
 
 #include "CError.h"
 
@@ -35,35 +37,22 @@ void CAmigaImage::Init( CChunkyImage& image )
         throw CError("Image must have a width multiple of 16.");
     }
 
-    //Allocating memory for bitplanes
-    std::size_t bitplaneSz = (image.GetWidth()*image.GetHeight()) >> 3;
-    if (_pBitplanes != nullptr) {
-      delete[] _pBitplanes;
-    }
-    _pBitplanes = new uint8_t[BITPLANE_DEPTH_MAX * bitplaneSz];
-
     //Setting up the "viewport"
     _viewport.bitplaneDepth = { static_cast<unsigned int>(std::ceil(std::log2(image.GetPalette().size()))) };
     _viewport.viewportMode = 0;
     _viewport.width = static_cast<uint16_t>(image.GetWidth());
     _viewport.height = static_cast<uint16_t>(image.GetHeight());
-    for (auto i = 0; i < BITPLANE_DEPTH_MAX; i++) {
-        _viewport.bitplanes[i] = &_pBitplanes[i*bitplaneSz];
-    }
     amiVideo_initScreen(_screen, _viewport.width, _viewport.height, _viewport.bitplaneDepth, OCS_COLORS_PER_CHANNEL, _viewport.viewportMode);
-    amiVideo_setScreenBitplanePointers(_screen, _viewport.bitplanes);//Set the bitplane pointers to the pointers in the viewport
     
     //Setting up the input palette
     _screen->palette.chunkyFormat.numOfColors = static_cast<unsigned>(image.GetPalette().size());
     amiVideo_setChunkyPaletteColors(&(_screen->palette), (amiVideo_OutputColor*)(image.GetPalette().data()), static_cast<unsigned>(image.GetPalette().size()));
 
-    //Setting up the image data
-    unsigned int pitch = 0; // !! Ask the author of libilbm for a hint to the correct value...
-    amiVideo_setScreenUncorrectedChunkyPixelsPointer(_screen, (amiVideo_UByte*)(image.GetPixels().data()), pitch);
+    //Setting up the image data: a scanline of chunky pixels is width bytes long
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(_screen, (amiVideo_UByte*)(image.GetPixels().data()), _viewport.width);
 
-    //CONVERTION!!
+    //CONVERTION!! The pixels are converted by Save(), scanline by scanline
     amiVideo_convertChunkyColorsToBitplaneFormat(&(_screen->palette));
-    amiVideo_convertScreenChunkyPixelsToBitplanes(_screen);    
     
     _isInitialized = true;
 }
@@ -79,9 +68,6 @@ CAmigaImage::~CAmigaImage(void)
     if (_screen != nullptr) {
       delete _screen;
     }
-    if (_pBitplanes != nullptr) {
-        delete[] _pBitplanes;
-    }
 }
 
 
@@ -97,7 +83,7 @@ void CAmigaImage::Save(const string & filepath)
     header->y = 0;
     header->nPlanes = _viewport.bitplaneDepth;
     header->masking = ILBM_MSK_NONE;
-    header->compression = ILBM_CMP_NONE;
+    header->compression = ILBM_CMP_BYTE_RUN;
     header->transparentColor = 0;
     header->xAspect = 11;
     header->yAspect = 10;
@@ -105,12 +91,6 @@ void CAmigaImage::Save(const string & filepath)
     header->pageHeight = _viewport.height;
     image->bitMapHeader = header; //Attach bitmap header to the image
     
-    //Interleaving the data
-    IFF_UByte* imageData = ILBM_interleaveFromBitplaneMemory(image, _viewport.bitplanes); //!!! imageData HAS TO BE FREED !!!
-    if (imageData == NULL) {
-        throw CError("Cannot allocate memory for bitplan conversion.");
-    }
-
     //Palette
     ILBM_ColorMap* colorMap = ILBM_createColorMap();  //must be freed using IFF_free()
     ILBM_ColorRegister *colorRegister;
@@ -129,19 +109,24 @@ void CAmigaImage::Save(const string & filepath)
     viewport->viewportMode = _screen->viewportMode;
     image->viewport = viewport;
 
-    //Adding data to ILBM image
-    //Attach data to the body chunk
-    auto rowSize = ILBM_calculateRowSize(image) * header->nPlanes;
-    IFF_RawChunk* body  = IFF_createRawChunk("BODY");
-    IFF_setRawChunkData(body, imageData, image->bitMapHeader->h*rowSize);
-    image->body = body;
-
-    IFF_Form * output = ILBM_convertImageToForm(image);
-    if (ILBM_write(filepath.data(), (IFF_Chunk*)output) != TRUE) {
+    //Writing the chunks of the image, then the body
+    ILBM_Writer* writer = ILBM_openWriter(filepath.data(), image); //always frees the chunks of the image, even on failure
+    ILBM_freeImage(image);
+    if (writer == nullptr) {
         throw CError("Cannot write to the output file.");
     }
 
-    //Free memory
-    free(imageData);
+    //Each scanline is converted to the interleaved rows of its bitplanes, which are packed and appended to the body
+    std::vector<IFF_UByte> scanline(static_cast<std::size_t>(_screen->bitplaneFormat.pitch) * _viewport.bitplaneDepth);
+    bool isWritten = true;
+    for (unsigned int y = 0; isWritten && y < static_cast<unsigned int>(_viewport.height); y++) {
+        amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(_screen, y, 1, scanline.data());
+        isWritten = ILBM_writeScanLine(writer, scanline.data()) == TRUE;
+    }
+
+    //The sizes of the BODY and FORM chunks are written back on closing
+    if (ILBM_closeWriter(writer) != TRUE || !isWritten) {
+        throw CError("Cannot write to the output file.");
+    }
 }
 
@@ -19,58 +19,153 @@
 #include <cstdint>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 #include "CError.h"
 #include "CPalette.h"
 #include "CChunkyImage.h"
+#include "CQuantizer.h"
+#include "CPaletteRefiner.h"
+#include "CThreadPool.h"
 
 
-CChunkyImage CChunkyImageFactory::GetImage(Geometry area, const string& size) const
+Image CChunkyImageFactory::Resize(const Image& img, const string& size, const bool filter)
 {
-  Image img(_imageRGB, area);
-  CChunkyImage subImg;
-  subImg._imageRGB = img;
-
-  if (size != "!") {
-    // resize : width must be a multiple of 16!
-    Geometry sz(size);
-    subImg._imageRGB.sample(sz);
-    const auto newWidth = subImg._imageRGB.size().width();
-    const auto mod = newWidth % 16;
-    // if size's not forced
-    if (size.find("!") == std::string::npos) {
-      if (mod != 0) { //Fit the image in a width multiple of 16
-        sz.width(newWidth - mod);
-        subImg._imageRGB = img;
-        subImg._imageRGB.sample(sz);
-      }
+  const auto scale = [filter](Image& image, const Geometry& geometry) {
+    if (filter) {
+      image.resize(geometry);
     }
-    //if size's forced
     else {
-      if (mod != 0) {
-        string msg("When size if forced, width must be multiple of 16.");
-        throw CError(msg);
-      }
+      image.sample(geometry);
+    }
+  };
+
+  Image resized(img);
+  if (size == "!") {
+    return resized;
+  }
+
+  // resize : width must be a multiple of 16!
+  Geometry sz(size);
+  scale(resized, sz);
+  const auto newWidth = resized.size().width();
+  const auto mod = newWidth % 16;
+  // if size's not forced
+  if (size.find("!") == std::string::npos) {
+    if (mod != 0) { //Fit the image in a width multiple of 16
+      sz.width(newWidth - mod);
+      resized = img;
+      scale(resized, sz);
     }
   }
+  //if size's forced
+  else {
+    if (mod != 0) {
+      string msg("When size if forced, width must be multiple of 16.");
+      throw CError(msg);
+    }
+  }
+  return resized;
+}
+
+Image CChunkyImageFactory::Load(const string& filename, const string& size)
+{
+  Image img;
+  if (size == "!") {
+    img.read(filename);
+    return img;
+  }
+  const Geometry target(size);
+  if (target.width() == 0 || target.height() == 0) {
+    img.read(filename);
+    return img;
+  }
+
+  // Both dimensions are kept above the margin, whatever the aspect ratio requested
+  const auto minWidth = target.width() * SHRINK_ON_LOAD_MARGIN;
+  const auto minHeight = target.height() * SHRINK_ON_LOAD_MARGIN;
+  std::ostringstream hint;
+  hint << minWidth << 'x' << minHeight;
+  img.defineValue("jpeg", "size", hint.str()); // DCT scaling while decoding
+  img.read(filename);
+
+  const auto ratio = std::max(static_cast<double>(minWidth) / img.columns(), static_cast<double>(minHeight) / img.rows());
+  if (ratio < 1.0)
+  {
+    Geometry reduced(static_cast<size_t>(std::ceil(img.columns() * ratio)), static_cast<size_t>(std::ceil(img.rows() * ratio)));
+    reduced.aspect(true);
+    img.scale(reduced);
+  }
+  return img;
+}
+
+CChunkyImage CChunkyImageFactory::GetImage(const Image& imgSource, const string& size) const
+{
+  if (_ditherer)
+  {
+    // dithered at the final size, straight to the indices
+    CChunkyImage subImg;
+    subImg._imageRGB = Resize(imgSource, size, false);
+    subImg._palette = _palette;
+    _ditherer->Dither(subImg._imageRGB, subImg._imageIdx);
+    subImg.FillRGB();
+    subImg._isInitialized = true;
+    return subImg;
+  }
+
+  if (!_dither && !_exact)
+  {
+    // each pixel is mapped on its own, in the inverse colormap of the palette
+    CChunkyImage subImg;
+    subImg._imageRGB = Resize(imgSource, size, false);
+    subImg._palette = _palette;
+    const auto width = subImg._imageRGB.size().width();
+    const auto height = subImg._imageRGB.size().height();
+    const PixelPacket* pixels = subImg._imageRGB.getConstPixels(0, 0, width, height);
+    std::vector<rgba8Bits_t> colors(width * height);
+    CThreadPool::GetInstance().ParallelFor(height, [&](const size_t y)
+    {
+      for (size_t x = y * width; x < (y + 1) * width; ++x) {
+        colors[x] = rgba8Bits_t{ pixels[x].red, pixels[x].green, pixels[x].blue };
+      }
+    });
+    std::vector<uint16_t> indices;
+    _palette.GetNearestIndices(colors, indices);
+    subImg._imageIdx.assign(indices.begin(), indices.end());
+    subImg.FillRGB();
+    subImg._isInitialized = true;
+    return subImg;
+  }
+
+  // the images already made of the colors of the palette are not dithered
+  Image img(imgSource);
+  if (!_exact) {
+    img.map(_map, true);
+  }
+  CChunkyImage subImg;
+  // sampling does not introduce new colors
+  subImg._imageRGB = Resize(img, size, false);
   subImg._palette = _palette;
 
-  const auto nbPixels = subImg._imageRGB.size().width() * subImg._imageRGB.size().height();
-  MagickCore::PixelPacket* pixel = subImg._imageRGB.getPixels(0, 0, subImg._imageRGB.size().width(), subImg._imageRGB.size().height());
-  for (unsigned int i = 0; i < nbPixels; i++)
+  // The pixels are read from the calling thread, then indexed by rows in parallel
+  const auto width = subImg._imageRGB.size().width();
+  const auto height = subImg._imageRGB.size().height();
+  subImg._imageIdx.resize(width * height);
+  const PixelPacket* pixels = subImg._imageRGB.getConstPixels(0, 0, width, height);
+  CThreadPool::GetInstance().ParallelFor(height, [&](const size_t y)
   {
-    rgba8Bits_t color{ pixel->red , pixel->green, pixel->blue };
-    ++pixel;
-    
-    const auto hColor = std::find(subImg._palette.begin(), subImg._palette.end(), color);
-    if (hColor == subImg._palette.end()) {
+    const PixelPacket* pixel = pixels + y * width;
+    uint8_t* idx = subImg._imageIdx.data() + y * width;
+    for (size_t x = 0; x < width; ++x, ++pixel)
+    {
+      const rgba8Bits_t color{ pixel->red, pixel->green, pixel->blue };
+      const auto found = _ocsIndices[OcsKey(color)];
+      if (found < 0 || !(_palette[found] == color)) {
         throw CError("Palette is too small.");
+      }
+      idx[x] = static_cast<uint8_t>(found);
     }
-    else {
-      const auto idx = static_cast<uint8_t>(hColor - subImg._palette.begin());
-      subImg._imageIdx.push_back(idx);
-    }
-  }
+  });
 
   subImg._isInitialized = true;
   return subImg;
@@ -78,42 +173,167 @@ CChunkyImage CChunkyImageFactory::GetImage(Geometry area, const string& size) co
 
 void CChunkyImageFactory::Init(const Image& img, const unsigned int nbColors, const bool dither, const CPalette& paletteSpace)
 {
+  if (_samplePixels != 0 && static_cast<uint64_t>(img.size().width()) * img.size().height() > _samplePixels)
+  {
+    CColorHistogram sample, validation;
+    sample.AddSample(img, _samplePixels, SAMPLE_SEED);
+    validation.AddSample(img, _samplePixels, SAMPLE_SEED + 1);
+    if (InitSampled(sample, validation, nbColors, dither, paletteSpace)) {
+      _imageRGB = img;
+      return;
+    }
+  }
+  CColorHistogram histogram;
+  histogram.Add(img);
+  Init(histogram, nbColors, dither, paletteSpace);
+  _imageRGB = img;
+}
+
+bool CChunkyImageFactory::InitSampled(const CColorHistogram& sample, const CColorHistogram& validation, const unsigned int nbColors,
+                                      const bool dither, const CPalette& paletteSpace)
+{
+  Init(sample, nbColors, dither, paletteSpace);
+  // only all the pixels can tell that the images are made of the colors of the sample
+  if (_exact) {
+    return false;
+  }
+  // colors missed by the sample show up as a higher mean distance on the other one
+  _sampled = validation.GetMeanError(_palette) <= sample.GetMeanError(_palette) * (1.0 + _sampleMaxError) + 1e-9;
+  return _sampled;
+}
+
+void CChunkyImageFactory::Init(const CColorHistogram& histogram, const unsigned int nbColors, const bool dither, const CPalette& paletteSpace)
+{
+  _sampled = false;
   if (nbColors > OCS_MAX_COLORS || nbColors < 2) {
     std::ostringstream maxColors;
     maxColors << OCS_MAX_COLORS;
     string msg("Number of colors must be between 2 and " + maxColors.str() + ".");
     throw CError(msg);
   }
+  if (histogram.GetNbPixels() == 0) {
+    throw CError("No pixel to compute the palette from.");
+  }
+
+  _dither = dither;
+  CPalette space = paletteSpace;
+  space.SetMetric(_metric);
+
+  // Images already made of few colors of the space, as pixel art, are kept as they are
+  std::vector<rgba8Bits_t> colors;
+  std::vector<uint64_t> counts;
+  _exact = histogram.GetNbColors() <= nbColors;
+  if (_exact) {
+    histogram.GetColors(colors, counts);
+    std::vector<uint32_t> nearest(colors.size());
+    space.SearchNearestIndices(colors.data(), colors.size(), nearest.data());
+    for (size_t i = 0; i < colors.size() && _exact; ++i) {
+      _exact = space[nearest[i]] == colors[i];
+    }
+  }
+
+  if (_exact) {
+    _palette = CPalette{ colors };
+  }
+  else if (_quantizer == Quantizer::WU) {
+    // The colors are directly selected among those of the space
+    _palette = CQuantizer::Quantize(histogram, nbColors, space);
+  }
+  else {
+    _palette = QuantizeMagick(histogram, nbColors, space);
+  }
+  if (_refineIterations > 0 && !_exact) {
+    _palette = CPaletteRefiner{ histogram }.Refine(_palette, space, _refineIterations, _refineMilliseconds, _refineSeed);
+  }
+  _palette.SetMetric(_metric);
+
+
+  // now the map only contains valid Amiga colors
+  _map = Image(Geometry(_palette.size(), 1), "white");
+  MagickCore::PixelPacket* pixel = _map.getPixels(0, 0, _map.size().width(), _map.size().height());
+  for (const auto& color : _palette)
+  {
+    pixel->red = color.r << (8 * (sizeof(pixel->red) - 1));
+    pixel->green = color.g << (8 * (sizeof(pixel->green) - 1));
+    pixel->blue = color.b << (8 * (sizeof(pixel->blue) - 1));
+    ++pixel;
+  }
+  _map.syncPixels();
+
+  // index of each 12 bit color in the palette, the first one being kept
+  _ocsIndices.assign(1u << 12, -1);
+  for (size_t i = _palette.size(); i-- > 0; ) {
+    _ocsIndices[OcsKey(_palette[i])] = static_cast<int16_t>(i);
+  }
+
+  // the mixing plans cached by the ditherer will serve all the images
+  _ditherer.reset();
+  if (_dither && !_exact && _ditherMethod != DitherMethod::MAGICK) {
+    _ditherer = std::make_shared<const CDitherer>(MakeDitherer());
+  }
+}
+
+CPalette CChunkyImageFactory::QuantizeMagick(const CColorHistogram& histogram, const unsigned int nbColors, const CPalette& paletteSpace)
+{
+  // The histogram, as an image, is color reduced: the dithering will take place
+  // while mapping the images themselves
+  Image colors = histogram.GetImage(QUANTIZE_MAX_PIXELS);
+  colors.quantizeColors(nbColors);
+  colors.quantizeDither(false);
+  colors.quantize();
 
-  _imageRGB = img;
- 
   // Constrain the colors to the provided Palette. We cannot only use the
   // default quantization, because that will introduce colorshifts to better
   // represent neighbouring pixel regions, it does not respect the colors
   // already in the image.
-  _imageRGB.quantizeColors(nbColors);
-  _imageRGB.quantizeDither(dither);
-  _imageRGB.quantizeDitherMethod(Magick::FloydSteinbergDitherMethod);
-  //_imageRGB.orderedDither("o3x3,2");
-  _imageRGB.quantize();
-  // now map the color reduced image using a map that only contains valid Amiga colors
-  CPalette quantizedPalette = CPaletteFactory::GetInstance().GetUniqueColors(_imageRGB);
-  Image map(Geometry(quantizedPalette.size(), 1), "white");
-  MagickCore::PixelPacket* pixel = map.getPixels(0, 0, map.size().width(), map.size().height());
-  for (std::size_t i = 0u; i < quantizedPalette.size(); ++i)
+  // The images will be mapped from the originals, which can potentially match slightly better
+  CPalette quantizedPalette = CPaletteFactory::GetInstance().GetUniqueColors(colors);
+  std::vector<uint32_t> nearest(quantizedPalette.size());
+  paletteSpace.SearchNearestIndices(quantizedPalette.data(), quantizedPalette.size(), nearest.data());
+  std::unordered_map<unsigned int, rgba8Bits_t> amigaColors;
+  for (const auto idx : nearest) {
+    amigaColors.insert({ paletteSpace[idx].Hash(), paletteSpace[idx] });
+  }
+  return CPalette{ amigaColors };
+}
+
+CDitherer CChunkyImageFactory::MakeDitherer(void) const
+{
+  switch (_ditherMethod)
   {
-    const auto nearestAmigaColor = paletteSpace.GetNearestColor(quantizedPalette[i]);
-    pixel->red = nearestAmigaColor.r << (8 * (sizeof(pixel->red) - 1));
-    pixel->green = nearestAmigaColor.g << (8 * (sizeof(pixel->green) - 1));
-    pixel->blue = nearestAmigaColor.b << (8 * (sizeof(pixel->blue) - 1));
-    ++pixel;
+  case DitherMethod::SIERRA_LITE:
+    return CDitherer{ _palette, CDitherer::SIERRA_LITE, _serpentine };
+  case DitherMethod::ATKINSON:
+    return CDitherer{ _palette, CDitherer::ATKINSON, _serpentine };
+  case DitherMethod::BAYER_2X2:
+    return CDitherer{ _palette, CDitherer::BAYER_2X2 };
+  case DitherMethod::BAYER_4X4:
+    return CDitherer{ _palette, CDitherer::BAYER_4X4 };
+  case DitherMethod::BAYER_8X8:
+    return CDitherer{ _palette, CDitherer::BAYER_8X8 };
+  case DitherMethod::BLUE_NOISE:
+    return CDitherer{ _palette, CDitherer::BLUE_NOISE };
+  case DitherMethod::MIXING_PLANS:
+    return CDitherer{ _palette, CDitherer::BAYER_8X8, true };
+  default:
+    return CDitherer{ _palette, CDitherer::FLOYD_STEINBERG, _serpentine };
   }
-  map.syncPixels();
-  // map again from the original, which can potentially match slightly better
-  _imageRGB = img;
-  _imageRGB.map(map, dither);
+}
 
-  _palette = CPaletteFactory::GetInstance().GetUniqueColors(_imageRGB);
+void CChunkyImage::FillRGB()
+{
+  constexpr unsigned shift = 8 * (sizeof(Quantum) - 1);
+  const auto width = _imageRGB.size().width();
+  const auto height = _imageRGB.size().height();
+  PixelPacket* pixel = _imageRGB.getPixels(0, 0, width, height);
+  for (const auto idx : _imageIdx)
+  {
+    pixel->red = _palette[idx].r << shift;
+    pixel->green = _palette[idx].g << shift;
+    pixel->blue = _palette[idx].b << shift;
+    ++pixel;
+  }
+  _imageRGB.syncPixels();
 }
 
 void CChunkyImage::Save(const string& filename)
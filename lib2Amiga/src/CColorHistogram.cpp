@@ -0,0 +1,265 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "CThreadPool.h"
+#include "CColorHistogram.h"
+
+
+void CColorHistogram::Add(const Magick::Image& image)
+{
+  const auto width = image.size().width();
+  const auto height = image.size().height();
+  if (width == 0 || height == 0) {
+    return;
+  }
+
+  // The pixels are read from the calling thread, then counted by tiles of rows in parallel
+  const PixelPacket* pixels = image.getConstPixels(0, 0, width, height);
+  const auto rowsPerTile = std::max<std::size_t>(1u, TILE_PIXELS / width);
+  const auto nbTiles = (height + rowsPerTile - 1) / rowsPerTile;
+  std::vector<Counts> tiles(nbTiles);
+  auto& threadPool = CThreadPool::GetInstance();
+  threadPool.ParallelFor(nbTiles, [&](const std::size_t tile)
+  {
+    const auto firstRow = tile * rowsPerTile;
+    const auto nbRows = std::min(rowsPerTile, height - firstRow);
+    CountTile(pixels + firstRow * width, nbRows * width, tiles[tile]);
+  });
+
+  // Merged two by two
+  for (std::size_t step = 1; step < nbTiles; step *= 2)
+  {
+    threadPool.ParallelFor((nbTiles + 2 * step - 1) / (2 * step), [&](const std::size_t pair)
+    {
+      const auto first = 2 * pair * step;
+      if (first + step < nbTiles) {
+        Counts merged;
+        MergeCounts(tiles[first], tiles[first + step], merged);
+        tiles[first].swap(merged);
+        Counts{}.swap(tiles[first + step]);
+      }
+    });
+  }
+  Counts merged;
+  MergeCounts(_counts, tiles[0], merged);
+  _counts.swap(merged);
+  _nbPixels += width * height;
+}
+
+
+void CColorHistogram::AddSample(const Magick::Image& image, const uint64_t maxPixels, const uint32_t seed)
+{
+  const auto width = image.size().width();
+  const auto height = image.size().height();
+  if (static_cast<uint64_t>(width) * height <= maxPixels) {
+    Add(image);
+    return;
+  }
+
+  // Stratified: a pixel at random in each cell. Each row of cells has its own generator.
+  const auto cellSize = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(width) * height / std::max<uint64_t>(1u, maxPixels))));
+  const auto nbColumns = (width + cellSize - 1) / cellSize;
+  const auto nbRows = (height + cellSize - 1) / cellSize;
+  const PixelPacket* pixels = image.getConstPixels(0, 0, width, height);
+  std::vector<PixelPacket> sample(nbColumns * nbRows);
+  CThreadPool::GetInstance().ParallelFor(nbRows, [&](const std::size_t row)
+  {
+    std::mt19937 random{ seed ^ static_cast<uint32_t>(row * 0x9E3779B9u) };
+    const auto top = row * cellSize;
+    const auto cellHeight = std::min(cellSize, height - top);
+    for (std::size_t column = 0; column < nbColumns; ++column)
+    {
+      const auto left = column * cellSize;
+      const auto cellWidth = std::min(cellSize, width - left);
+      const auto x = left + random() % cellWidth;
+      const auto y = top + random() % cellHeight;
+      sample[row * nbColumns + column] = pixels[y * width + x];
+    }
+  });
+
+  Counts counts;
+  CountTile(sample.data(), sample.size(), counts);
+  Counts merged;
+  MergeCounts(_counts, counts, merged);
+  _counts.swap(merged);
+  _nbPixels += sample.size();
+}
+
+
+void CColorHistogram::CountTile(const PixelPacket* pixels, const std::size_t nbPixels, Counts& counts)
+{
+  std::vector<uint32_t> keys(nbPixels);
+  bool ocs = true;
+  for (std::size_t i = 0; i < nbPixels; ++i)
+  {
+    const rgba8Bits_t color{ pixels[i].red, pixels[i].green, pixels[i].blue };
+    keys[i] = color.Hash();
+    // an OCS channel is x * 17: its two nibbles are the same
+    ocs = ocs && (color.r >> 4) == (color.r & 0xF) && (color.g >> 4) == (color.g & 0xF) && (color.b >> 4) == (color.b & 0xF);
+  }
+
+  counts.clear();
+  if (ocs)
+  {
+    std::vector<uint64_t> table(1u << 12, 0);
+    for (const auto key : keys) {
+      ++table[((key >> 12) & 0xF00) | ((key >> 8) & 0xF0) | ((key >> 4) & 0xF)];
+    }
+    for (unsigned int i = 0; i < table.size(); ++i) {
+      if (table[i] != 0) {
+        counts.emplace_back(((i & 0xF00) << 8 | (i & 0xF0) << 4 | (i & 0xF)) * 0x11, table[i]);
+      }
+    }
+    return;
+  }
+
+  // Least significant digit radix sort, 8 bits at a time
+  std::vector<uint32_t> sorted(nbPixels);
+  for (unsigned int shift = 0; shift < 24; shift += 8)
+  {
+    std::size_t offsets[256] = {};
+    for (const auto key : keys) {
+      ++offsets[(key >> shift) & 0xFF];
+    }
+    std::size_t offset = 0;
+    for (auto& digit : offsets) {
+      const auto count = digit;
+      digit = offset;
+      offset += count;
+    }
+    for (const auto key : keys) {
+      sorted[offsets[(key >> shift) & 0xFF]++] = key;
+    }
+    keys.swap(sorted);
+  }
+  for (std::size_t i = 0; i < nbPixels; )
+  {
+    auto end = i + 1;
+    while (end < nbPixels && keys[end] == keys[i]) {
+      ++end;
+    }
+    counts.emplace_back(keys[i], end - i);
+    i = end;
+  }
+}
+
+
+void CColorHistogram::MergeCounts(const Counts& counts1, const Counts& counts2, Counts& merged)
+{
+  merged.clear();
+  merged.reserve(counts1.size() + counts2.size());
+  auto it1 = counts1.begin();
+  auto it2 = counts2.begin();
+  while (it1 != counts1.end() && it2 != counts2.end())
+  {
+    if (it1->first < it2->first) {
+      merged.push_back(*it1++);
+    }
+    else if (it2->first < it1->first) {
+      merged.push_back(*it2++);
+    }
+    else {
+      merged.emplace_back(it1->first, it1->second + it2->second);
+      ++it1;
+      ++it2;
+    }
+  }
+  merged.insert(merged.end(), it1, counts1.end());
+  merged.insert(merged.end(), it2, counts2.end());
+}
+
+
+void CColorHistogram::Merge(const CColorHistogram& other)
+{
+  Counts merged;
+  MergeCounts(_counts, other._counts, merged);
+  _counts.swap(merged);
+  _nbPixels += other._nbPixels;
+}
+
+
+void CColorHistogram::GetColors(std::vector<rgba8Bits_t>& colors, std::vector<uint64_t>& counts) const
+{
+  colors.resize(_counts.size());
+  counts.resize(_counts.size());
+  for (std::size_t i = 0; i < _counts.size(); ++i)
+  {
+    colors[i].r = (_counts[i].first >> 16) & 0xFF;
+    colors[i].g = (_counts[i].first >> 8) & 0xFF;
+    colors[i].b = _counts[i].first & 0xFF;
+    counts[i] = _counts[i].second;
+  }
+}
+
+
+Magick::Image CColorHistogram::GetImage(const uint64_t maxPixels) const
+{
+  Counts counts{ _counts };
+
+  const auto scale = _nbPixels > maxPixels ? static_cast<double>(maxPixels) / _nbPixels : 1.0;
+  uint64_t width = 0;
+  for (auto& count : counts) {
+    count.second = std::max<uint64_t>(1u, static_cast<uint64_t>(count.second * scale + 0.5));
+    width += count.second;
+  }
+  if (width == 0) {
+    return Magick::Image{};
+  }
+
+  constexpr unsigned shift = 8 * (sizeof(Magick::Quantum) - 1);
+  Magick::Image image(Magick::Geometry(width, 1), "black");
+  PixelPacket* pixel = image.getPixels(0, 0, width, 1);
+  for (const auto& count : counts)
+  {
+    const Magick::Quantum red = ((count.first >> 16) & 0xFF) << shift;
+    const Magick::Quantum green = ((count.first >> 8) & 0xFF) << shift;
+    const Magick::Quantum blue = (count.first & 0xFF) << shift;
+    for (uint64_t i = 0; i < count.second; ++i)
+    {
+      pixel->red = red;
+      pixel->green = green;
+      pixel->blue = blue;
+      ++pixel;
+    }
+  }
+  image.syncPixels();
+  return image;
+}
+
+
+double CColorHistogram::GetMeanError(const CPalette& palette) const
+{
+  if (_nbPixels == 0) {
+    return 0.0;
+  }
+  std::vector<rgba8Bits_t> colors;
+  std::vector<uint64_t> counts;
+  GetColors(colors, counts);
+  std::vector<uint32_t> nearest(colors.size());
+  palette.SearchNearestIndices(colors.data(), colors.size(), nearest.data());
+
+  double error = 0.0;
+  for (std::size_t i = 0; i < colors.size(); ++i) {
+    error += std::sqrt(palette.Distance(colors[i], palette[nearest[i]])) * counts[i];
+  }
+  return error / _nbPixels;
+}
@@ -0,0 +1,128 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+
+#include "CColorTree.h"
+
+
+CColorTree::CColorTree(const std::vector<rgba8Bits_t>& colors, const CPalette::Metric metric)
+  : _metric{ metric }
+{
+  // Only the first of identical colors is kept: it wins their ties, whatever the precision
+  // of the distances, which may be extended in registers
+  std::unordered_set<unsigned int> hashes;
+  _points.reserve(colors.size());
+  for (std::size_t i = 0; i < colors.size(); ++i)
+  {
+    if (!hashes.insert(colors[i].Hash()).second) {
+      continue;
+    }
+    Point point;
+    CPalette::GetCoordinates(metric, colors[i], point.coords);
+    point.index = static_cast<uint32_t>(i);
+    _points.push_back(point);
+  }
+  if (!_points.empty()) {
+    _nodes.resize(1);
+    Build(0, 0, static_cast<uint32_t>(_points.size()));
+  }
+}
+
+
+void CColorTree::Build(const uint32_t node, const uint32_t begin, const uint32_t end)
+{
+  _nodes[node].begin = begin;
+  _nodes[node].end = end;
+  _nodes[node].axis = -1;
+  if (end - begin <= LEAF_SIZE) {
+    return;
+  }
+
+  // Split along the widest axis
+  int axis = 0;
+  auto widest = -1.0;
+  for (int a = 0; a < 3; ++a)
+  {
+    const auto bounds = std::minmax_element(_points.begin() + begin, _points.begin() + end,
+      [a](const Point& p1, const Point& p2) { return p1.coords[a] < p2.coords[a]; });
+    const auto width = bounds.second->coords[a] - bounds.first->coords[a];
+    if (width > widest) {
+      widest = width;
+      axis = a;
+    }
+  }
+  if (widest <= 0.0) {
+    return; // all the same color: a leaf
+  }
+  const auto middle = begin + (end - begin) / 2;
+  std::nth_element(_points.begin() + begin, _points.begin() + middle, _points.begin() + end,
+    [axis](const Point& p1, const Point& p2) { return p1.coords[axis] < p2.coords[axis]; });
+
+  const auto children = static_cast<uint32_t>(_nodes.size());
+  _nodes[node].axis = axis;
+  _nodes[node].split = _points[middle].coords[axis];
+  _nodes[node].children = children;
+  _nodes.resize(_nodes.size() + 2);
+  Build(children, begin, middle);
+  Build(children + 1, middle, end);
+}
+
+
+std::size_t CColorTree::GetNearestIndex(const rgba8Bits_t& color) const
+{
+  double coords[3];
+  CPalette::GetCoordinates(_metric, color, coords);
+  auto nearest = std::numeric_limits<double>::max();
+  std::size_t found = 0;
+  Search(0, coords, nearest, found);
+  return found;
+}
+
+
+void CColorTree::Search(const uint32_t node, const double* coords, double& nearest, std::size_t& found) const
+{
+  const auto& current = _nodes[node];
+  if (current.axis < 0)
+  {
+    // Same expression as rgba8Bits_t::Distance()
+    for (auto i = current.begin; i < current.end; ++i)
+    {
+      const auto d0 = _points[i].coords[0] - coords[0];
+      const auto d1 = _points[i].coords[1] - coords[1];
+      const auto d2 = _points[i].coords[2] - coords[2];
+      const auto distance = d0 * d0 + d1 * d1 + d2 * d2;
+      if (distance < nearest || (distance == nearest && _points[i].index < found)) {
+        nearest = distance;
+        found = _points[i].index;
+      }
+    }
+    return;
+  }
+
+  // The nearer child first. The points of the other one are at least as far as the split.
+  // Some slack, in case the compiler contracts the expressions of rgba8Bits_t::Distance() differently.
+  const auto difference = coords[current.axis] - current.split;
+  const auto nearer = difference < 0.0 ? current.children : current.children + 1;
+  Search(nearer, coords, nearest, found);
+  if (difference * difference <= nearest * (1.0 + 1e-9)) {
+    Search(nearer == current.children ? current.children + 1 : current.children, coords, nearest, found);
+  }
+}
@@ -0,0 +1,642 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DITHERER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "CError.h"
+#include "CThreadPool.h"
+#include "CDitherer.h"
+
+//statics
+const CDitherer::Kernel CDitherer::FLOYD_STEINBERG = { { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } }, 4, 4 };
+const CDitherer::Kernel CDitherer::SIERRA_LITE = { { { 1, 0, 2 }, { -1, 1, 1 }, { 0, 1, 1 } }, 3, 2 };
+const CDitherer::Kernel CDitherer::ATKINSON = { { { 1, 0, 1 }, { 2, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }, { 0, 2, 1 } }, 6, 3 };
+
+namespace
+{
+  const uint8_t Bayer2x2[] = {
+     0,  2,
+     3,  1
+  };
+  const uint8_t Bayer4x4[] = {
+     0,  8,  2, 10,
+    12,  4, 14,  6,
+     3, 11,  1,  9,
+    15,  7, 13,  5
+  };
+  const uint8_t Bayer8x8[] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+  };
+  // Generated with the void-and-cluster method, gaussian sigma 1.5, on a torus
+  const uint8_t BlueNoise16x16[] = {
+    234,  50, 188,  19,  58, 171, 121,  47, 163,   1, 247, 104,  22, 132,  14,  65,
+    209,   8, 118,  97, 240, 205,  23, 228, 138,  64, 123, 170,  72, 224,  99, 149,
+     85, 139, 229, 165,  78, 146, 111,  84, 176, 216,  30, 231, 153, 201,  42, 180,
+     25,  62, 195,  29,  43, 185,   7, 249,  41, 100, 191,  48,  87,   5, 128, 243,
+    221, 152, 101, 253, 130, 220,  59, 200, 156,  12, 136, 112, 255, 174,  69, 109,
+     46, 189,   0,  73, 172,  90, 142, 116,  80, 237, 210,  61, 147,  33, 206, 160,
+     81, 124, 217, 113, 208,  15, 241,  27, 168,  45, 178,  20, 193,  96, 225,  18,
+    242, 164,  60,  35, 157,  53, 181,  68, 223, 105, 125,  83, 236, 131,  55, 141,
+    197,  10, 227, 134, 246,  95, 126, 198, 148,   3, 244, 161,  71,   9, 182, 106,
+     40,  93, 179,  75, 192,   6, 218,  36,  91,  57, 202,  34, 215, 155, 233,  74,
+    252, 120, 150,  24, 110,  63, 166, 119, 232, 183, 133, 103,  49, 117,  31, 167,
+     16, 212,  51, 238, 207, 137, 254,  21,  76, 151,  13, 250, 190,  88, 203, 135,
+    102, 184,  82, 169,  38,  89, 187,  52, 204,  98, 173,  67, 129,   4, 222,  56,
+    230, 144,   2, 127, 226,  11, 154, 114, 239,  39, 219,  28, 235, 145, 175,  77,
+    196,  37, 248,  70, 107, 199,  66, 177,  17, 143, 115, 159,  86,  44, 108,  26,
+    122,  92, 158, 214, 140,  32, 245,  94, 213,  79, 194,  54, 211, 186, 251, 162
+  };
+}
+const CDitherer::ThresholdMap CDitherer::BAYER_2X2 = { 2, Bayer2x2 };
+const CDitherer::ThresholdMap CDitherer::BAYER_4X4 = { 4, Bayer4x4 };
+const CDitherer::ThresholdMap CDitherer::BAYER_8X8 = { 8, Bayer8x8 };
+const CDitherer::ThresholdMap CDitherer::BLUE_NOISE = { 16, BlueNoise16x16 };
+
+namespace
+{
+  const std::size_t LANES = 8;      //The palette is padded to a multiple of the widest SIMD registers
+  const float FAR_AWAY = 1.0e6f;    //Coordinates of the padding colors
+}
+
+
+CDitherer::CDitherer(const CPalette& palette)
+  : _palette{ palette },
+    _kernel(),
+    _thresholds()
+{
+  if (palette.empty() || palette.size() > 256) {
+    throw CError("The palette must have between 1 and 256 colors to be dithered to.");
+  }
+  const auto padded = (palette.size() + LANES - 1) / LANES * LANES;
+  _y.assign(padded, FAR_AWAY);
+  _u.assign(padded, FAR_AWAY);
+  _v.assign(padded, FAR_AWAY);
+  for (std::size_t i = 0; i < palette.size(); ++i)
+  {
+    const auto& color = palette[i];
+    _y[i] = static_cast<float>(rgba8Bits_t::LUMA_RED * color.r + rgba8Bits_t::LUMA_GREEN * color.g + rgba8Bits_t::LUMA_BLUE * color.b);
+    _u[i] = 0.492f * (color.b - _y[i]);
+    _v[i] = 0.877f * (color.r - _y[i]);
+  }
+}
+
+
+CDitherer::CDitherer(const CPalette& palette, const ThresholdMap& thresholds, const bool mixingPlans)
+  : CDitherer(palette)
+{
+  _thresholds = thresholds;
+  if (mixingPlans)
+  {
+    const std::size_t nbKeys = 1u << (3 * PLAN_KEY_BITS);
+    _plans = std::make_shared<PlanCache>();
+    _plans->states = std::vector<std::atomic<uint8_t>>(nbKeys);
+    for (auto& state : _plans->states) {
+      state.store(PLAN_EMPTY);
+    }
+    _plans->plans.resize(nbKeys * thresholds.size * thresholds.size);
+    return;
+  }
+
+  // The offsets span the mean distance between a color of the palette and its nearest neighbour,
+  // the same offset being added to the three channels
+  if (palette.size() < 2) {
+    return;
+  }
+  auto sum = 0.0;
+  for (const auto& color : palette)
+  {
+    auto nearest = std::numeric_limits<double>::max();
+    for (const auto& other : palette)
+    {
+      if (&other != &color) {
+        const auto dr = color.r - other.r;
+        const auto dg = color.g - other.g;
+        const auto db = color.b - other.b;
+        nearest = std::min(nearest, static_cast<double>(dr * dr + dg * dg + db * db));
+      }
+    }
+    sum += std::sqrt(nearest);
+  }
+  _spread = static_cast<float>(sum / palette.size() / std::sqrt(3.0));
+}
+
+
+CDitherer::CDitherer(const CPalette& palette, const Kernel& kernel, const bool serpentine)
+  : CDitherer(palette)
+{
+  _kernel = kernel;
+  _serpentine = serpentine;
+
+  // Lag of a row behind the row above, when they are dithered in parallel. A pixel starts when:
+  // - all the pixels diffusing their error to it are done;
+  // - the pixels of the rows above do not diffuse their errors where the current row is writing.
+  const auto isLagged = [this](const std::size_t lag) {
+    for (unsigned int i = 0; i < _kernel.nbTaps; ++i)
+    {
+      const auto& a = _kernel.taps[i];
+      if (a.dy > 0 && static_cast<int>(lag) * a.dy < 1 - a.dx) {
+        return false;
+      }
+      for (unsigned int j = 0; j < _kernel.nbTaps; ++j)
+      {
+        const auto& b = _kernel.taps[j];
+        if (a.dy > b.dy && static_cast<int>(lag) * (a.dy - b.dy) <= b.dx - a.dx) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+  while (!isLagged(_lag)) {
+    ++_lag;
+  }
+}
+
+
+void CDitherer::Dither(const Magick::Image& image, std::vector<uint8_t>& indices) const
+{
+  const auto width = image.size().width();
+  const auto height = image.size().height();
+  if (_plans) {
+    DitherMixingPlans(image, indices);
+    return;
+  }
+  if (_thresholds.size != 0) {
+    DitherOrdered(image, indices);
+    return;
+  }
+  indices.resize(width * height);
+  if (indices.empty()) {
+    return;
+  }
+
+  const auto rgb = GetRGB(image);
+  auto& threadPool = CThreadPool::GetInstance();
+  const auto stride = (width + 2 * PADDING) * 4;
+  // Serpentine: a reversed row starts where the row above ends, so it cannot start before
+  // the row above is done. The rows are dithered one after the other.
+  if (_serpentine || threadPool.GetNbThreads() == 1 || height == 1)
+  {
+    // Rolling buffer of MAX_DY + 1 error rows
+    std::vector<int16_t> errors(stride * (MAX_DY + 1), 0);
+    for (std::size_t y = 0; y < height; ++y) {
+      DitherRow(y, width, rgb.data(), indices.data(), errors.data(), stride, MAX_DY + 1, nullptr);
+    }
+    return;
+  }
+
+  // Wavefront: the rows are taken in order by the threads and each one follows the
+  // row above, _lag pixels behind. The errors are the same as with a single thread,
+  // only added in another order. At most one row per thread is in progress, so the
+  // buffer is recycled after nbTasks + MAX_DY rows.
+  const auto nbTasks = static_cast<std::size_t>(threadPool.GetNbThreads());
+  const auto nbRows = nbTasks + MAX_DY + 1;
+  std::vector<int16_t> errors(stride * nbRows, 0);
+  Wavefront wavefront;
+  wavefront.progress = std::vector<std::atomic<std::size_t>>(height);
+  for (auto& done : wavefront.progress) {
+    done.store(0);
+  }
+  std::atomic<std::size_t> nextRow{ 0 };
+  threadPool.ParallelFor(nbTasks, [&](const std::size_t)
+  {
+    for (auto y = nextRow++; y < height; y = nextRow++) {
+      DitherRow(y, width, rgb.data(), indices.data(), errors.data(), stride, nbRows, &wavefront);
+    }
+  });
+}
+
+
+void CDitherer::DitherOrdered(const Magick::Image& image, std::vector<uint8_t>& indices) const
+{
+  const auto width = image.size().width();
+  const auto height = image.size().height();
+  indices.resize(width * height);
+  if (indices.empty()) {
+    return;
+  }
+  const auto rgb = GetRGB(image);
+
+  // Thresholds as offsets centered on 0
+  const auto size = _thresholds.size;
+  std::vector<float> offsets(size * size);
+  for (std::size_t i = 0; i < offsets.size(); ++i) {
+    offsets[i] = ((_thresholds.thresholds[i] + 0.5f) / offsets.size() - 0.5f) * _spread;
+  }
+
+  CThreadPool::GetInstance().ParallelFor(height, [&](const std::size_t y)
+  {
+    const uint8_t* rowRGB = rgb.data() + y * width * 3;
+    const float* rowOffsets = offsets.data() + (y % size) * size;
+    uint8_t* rowIndices = indices.data() + y * width;
+    for (std::size_t x = 0; x < width; x += BLOCK)
+    {
+      float r[BLOCK], g[BLOCK], b[BLOCK];
+      uint8_t found[BLOCK];
+      const auto count = std::min(BLOCK, width - x);
+      for (std::size_t i = 0; i < BLOCK; ++i)
+      {
+        const auto pixel = rowRGB + 3 * (x + std::min(i, count - 1));
+        const auto offset = rowOffsets[(x + i) % size];
+        r[i] = std::min(std::max(pixel[0] + offset, 0.0f), 255.0f);
+        g[i] = std::min(std::max(pixel[1] + offset, 0.0f), 255.0f);
+        b[i] = std::min(std::max(pixel[2] + offset, 0.0f), 255.0f);
+      }
+      GetNearestIndices(r, g, b, found);
+      std::copy(found, found + count, rowIndices + x);
+    }
+  });
+}
+
+
+void CDitherer::DitherMixingPlans(const Magick::Image& image, std::vector<uint8_t>& indices) const
+{
+  const auto width = image.size().width();
+  const auto height = image.size().height();
+  indices.resize(width * height);
+  if (indices.empty()) {
+    return;
+  }
+  const auto rgb = GetRGB(image);
+
+  const auto size = _thresholds.size;
+  const auto keyShift = 8 - PLAN_KEY_BITS;
+  CThreadPool::GetInstance().ParallelFor(height, [&](const std::size_t y)
+  {
+    const uint8_t* pixel = rgb.data() + y * width * 3;
+    const uint8_t* rowThresholds = _thresholds.thresholds + (y % size) * size;
+    uint8_t* rowIndices = indices.data() + y * width;
+    for (std::size_t x = 0; x < width; ++x, pixel += 3)
+    {
+      const auto key = ((pixel[0] >> keyShift) << (2 * PLAN_KEY_BITS)) | ((pixel[1] >> keyShift) << PLAN_KEY_BITS) | (pixel[2] >> keyShift);
+      rowIndices[x] = GetPlan(key)[rowThresholds[x % size]];
+    }
+  });
+}
+
+
+const uint8_t* CDitherer::GetPlan(const unsigned int key) const
+{
+  const auto planSize = _thresholds.size * _thresholds.size;
+  uint8_t* plan = _plans->plans.data() + key * planSize;
+  auto& state = _plans->states[key];
+  if (state.load(std::memory_order_acquire) == PLAN_READY) {
+    return plan;
+  }
+
+  // The plan is computed by the first thread needing it, the others wait for it
+  uint8_t expected = PLAN_EMPTY;
+  if (!state.compare_exchange_strong(expected, PLAN_BUSY, std::memory_order_acquire))
+  {
+    for (unsigned int spins = 0; state.load(std::memory_order_acquire) != PLAN_READY; ++spins)
+    {
+      if (spins < MAX_SPINS) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_plans->mutex);
+      _plans->ready.wait(lock, [&state] { return state.load(std::memory_order_acquire) == PLAN_READY; });
+    }
+    return plan;
+  }
+
+  // The key expanded to an 8 bit color by replicating its high bits: the first and last keys are black and white
+  const auto mask = (1u << PLAN_KEY_BITS) - 1;
+  const auto expand = [](const unsigned int value) {
+    return static_cast<uint8_t>((value << (8 - PLAN_KEY_BITS)) | (value >> (2 * PLAN_KEY_BITS - 8)));
+  };
+  rgba8Bits_t color;
+  color.r = expand((key >> (2 * PLAN_KEY_BITS)) & mask);
+  color.g = expand((key >> PLAN_KEY_BITS) & mask);
+  color.b = expand(key & mask);
+  ComputePlan(color, plan);
+  {
+    // the sleeping threads check the state under the lock: the notification cannot be missed
+    std::lock_guard<std::mutex> lock(_plans->mutex);
+    state.store(PLAN_READY, std::memory_order_release);
+  }
+  _plans->ready.notify_all();
+  return plan;
+}
+
+
+void CDitherer::ComputePlan(const rgba8Bits_t& color, uint8_t* plan) const
+{
+  // Yliluoma's algorithm 2: the plan grows with the color whose addition, repeated
+  // up to doubling the plan, brings its mean the closest to the color
+  const auto planSize = _thresholds.size * _thresholds.size;
+  const auto lumaRed = static_cast<float>(rgba8Bits_t::LUMA_RED);
+  const auto lumaGreen = static_cast<float>(rgba8Bits_t::LUMA_GREEN);
+  const auto lumaBlue = static_cast<float>(rgba8Bits_t::LUMA_BLUE);
+  const auto y = color.r * lumaRed + color.g * lumaGreen + color.b * lumaBlue;
+  const auto u = 0.492f * (color.b - y);
+  const auto v = 0.877f * (color.r - y);
+
+  float soFar[3] = { 0.0f, 0.0f, 0.0f };
+  unsigned int total = 0;
+  while (total < planSize)
+  {
+    auto leastPenalty = std::numeric_limits<float>::max();
+    std::size_t chosen = 0;
+    unsigned int chosenAmount = 1;
+    const auto maxAmount = std::min(std::max(1u, total), planSize - total);
+    for (std::size_t k = 0; k < _palette.size(); ++k)
+    {
+      const auto& candidate = _palette[k];
+      for (unsigned int amount = 1; amount <= maxAmount; amount *= 2)
+      {
+        const auto count = static_cast<float>(total + amount);
+        const auto r = (soFar[0] + candidate.r * amount) / count;
+        const auto g = (soFar[1] + candidate.g * amount) / count;
+        const auto b = (soFar[2] + candidate.b * amount) / count;
+        const auto testY = r * lumaRed + g * lumaGreen + b * lumaBlue;
+        const auto dy = testY - y;
+        const auto du = 0.492f * (b - testY) - u;
+        const auto dv = 0.877f * (r - testY) - v;
+        const auto penalty = (dy * dy + du * du) + dv * dv;
+        if (penalty < leastPenalty) {
+          leastPenalty = penalty;
+          chosen = k;
+          chosenAmount = amount;
+        }
+      }
+    }
+    std::fill(plan + total, plan + total + chosenAmount, static_cast<uint8_t>(chosen));
+    soFar[0] += _palette[chosen].r * chosenAmount;
+    soFar[1] += _palette[chosen].g * chosenAmount;
+    soFar[2] += _palette[chosen].b * chosenAmount;
+    total += chosenAmount;
+  }
+
+  // The darkest colors go to the lowest thresholds
+  std::stable_sort(plan, plan + planSize, [this](const uint8_t a, const uint8_t b) { return _y[a] < _y[b]; });
+}
+
+
+std::vector<uint8_t> CDitherer::GetRGB(const Magick::Image& image)
+{
+  const auto nbPixels = image.size().width() * image.size().height();
+  std::vector<uint8_t> rgb;
+  rgb.reserve(nbPixels * 3);
+  const PixelPacket* pixel = image.getConstPixels(0, 0, image.size().width(), image.size().height());
+  for (std::size_t i = 0; i < nbPixels; ++i, ++pixel)
+  {
+    const rgba8Bits_t color{ pixel->red, pixel->green, pixel->blue };
+    rgb.push_back(color.r);
+    rgb.push_back(color.g);
+    rgb.push_back(color.b);
+  }
+  return rgb;
+}
+
+
+void CDitherer::DitherRow(const std::size_t y, const std::size_t width, const uint8_t* rgb, uint8_t* indices,
+                          int16_t* errors, const std::size_t stride, const std::size_t nbRows, Wavefront* wavefront) const
+{
+  int16_t* rows[MAX_DY + 1];
+  for (int dy = 0; dy <= MAX_DY; ++dy) {
+    rows[dy] = errors + ((y + dy) % nbRows) * stride + PADDING * 4;
+  }
+  const bool reverse = _serpentine && (y & 1) != 0;
+  const int direction = reverse ? -1 : 1;
+  const uint8_t* rowRGB = rgb + y * width * 3;
+  uint8_t* rowIndices = indices + y * width;
+  const int maxValue = 0xFF << ERROR_BITS;
+  const std::atomic<std::size_t>* above = wavefront != nullptr && y > 0 ? &wavefront->progress[y - 1] : nullptr;
+  std::atomic<std::size_t>* progress = wavefront != nullptr ? &wavefront->progress[y] : nullptr;
+  std::size_t aboveDone = 0;
+  // Sequentially consistent with the count of sleepers: either a sleeper sees the progress, or it is woken up
+  const auto advance = [wavefront, progress](const std::size_t done) {
+    progress->store(done);
+    if (wavefront->sleepers.load() > 0) {
+      std::lock_guard<std::mutex> lock(wavefront->mutex);
+      wavefront->progressed.notify_all();
+    }
+  };
+
+  for (std::size_t n = 0; n < width; ++n)
+  {
+    if (above != nullptr)
+    {
+      const auto needed = std::min(n + _lag, width);
+      for (unsigned int spins = 0; aboveDone < needed; ++spins)
+      {
+        aboveDone = above->load(std::memory_order_acquire);
+        if (aboveDone >= needed) {
+          break;
+        }
+        if (spins < MAX_SPINS) {
+          std::this_thread::yield();
+          continue;
+        }
+        // Announced before checking the progress again, so the row above cannot miss the sleeper
+        std::unique_lock<std::mutex> lock(wavefront->mutex);
+        ++wavefront->sleepers;
+        wavefront->progressed.wait(lock, [&] { return (aboveDone = above->load()) >= needed; });
+        --wavefront->sleepers;
+      }
+    }
+
+    const int x = static_cast<int>(reverse ? width - 1 - n : n);
+    const int16_t* error = rows[0] + 4 * x;
+    const auto r = std::min(std::max((rowRGB[3 * x] << ERROR_BITS) + error[0], 0), maxValue);
+    const auto g = std::min(std::max((rowRGB[3 * x + 1] << ERROR_BITS) + error[1], 0), maxValue);
+    const auto b = std::min(std::max((rowRGB[3 * x + 2] << ERROR_BITS) + error[2], 0), maxValue);
+    const auto rounder = 1 << (ERROR_BITS - 1);
+    const auto idx = GetNearestIndex((r + rounder) >> ERROR_BITS, (g + rounder) >> ERROR_BITS, (b + rounder) >> ERROR_BITS);
+    rowIndices[x] = idx;
+
+    const auto& found = _palette[idx];
+    const int16_t quantError[4] = {
+      static_cast<int16_t>(r - (found.r << ERROR_BITS)),
+      static_cast<int16_t>(g - (found.g << ERROR_BITS)),
+      static_cast<int16_t>(b - (found.b << ERROR_BITS)),
+      0
+    };
+#if defined(__AVX2__) || defined(DITHERER_SSE2)
+    const auto quantErrors = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantError));
+    for (unsigned int t = 0; t < _kernel.nbTaps; ++t)
+    {
+      const auto& tap = _kernel.taps[t];
+      auto target = reinterpret_cast<__m128i*>(rows[tap.dy] + 4 * (x + direction * tap.dx));
+      const auto weighted = _mm_srai_epi16(_mm_mullo_epi16(quantErrors, _mm_set1_epi16(tap.weight)), _kernel.shift);
+      _mm_storel_epi64(target, _mm_add_epi16(_mm_loadl_epi64(target), weighted));
+    }
+#else
+    for (unsigned int t = 0; t < _kernel.nbTaps; ++t)
+    {
+      const auto& tap = _kernel.taps[t];
+      int16_t* target = rows[tap.dy] + 4 * (x + direction * tap.dx);
+      for (int c = 0; c < 3; ++c) {
+        target[c] = static_cast<int16_t>(target[c] + static_cast<int16_t>((quantError[c] * tap.weight) >> _kernel.shift));
+      }
+    }
+#endif
+    if (progress != nullptr && n + 1 < width) {
+      advance(n + 1);
+    }
+  }
+
+  // The current row is recycled as the last one, errors out of the image included
+  std::fill(rows[0] - PADDING * 4, rows[0] - PADDING * 4 + stride, static_cast<int16_t>(0));
+  if (progress != nullptr) {
+    advance(width);
+  }
+}
+
+
+uint8_t CDitherer::GetNearestIndex(const int r, const int g, const int b) const
+{
+  const auto y = static_cast<float>(rgba8Bits_t::LUMA_RED * r + rgba8Bits_t::LUMA_GREEN * g + rgba8Bits_t::LUMA_BLUE * b);
+  const auto u = 0.492f * (b - y);
+  const auto v = 0.877f * (r - y);
+
+  // distances to all the colors, the first minimum wins
+  alignas(32) float distances[256 + LANES];
+#if defined(__AVX2__)
+  const auto y8 = _mm256_set1_ps(y);
+  const auto u8 = _mm256_set1_ps(u);
+  const auto v8 = _mm256_set1_ps(v);
+  for (std::size_t i = 0; i < _y.size(); i += 8)
+  {
+    const auto dy = _mm256_sub_ps(y8, _mm256_loadu_ps(&_y[i]));
+    const auto du = _mm256_sub_ps(u8, _mm256_loadu_ps(&_u[i]));
+    const auto dv = _mm256_sub_ps(v8, _mm256_loadu_ps(&_v[i]));
+    _mm256_store_ps(distances + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(du, du)), _mm256_mul_ps(dv, dv)));
+  }
+#elif defined(DITHERER_SSE2)
+  const auto y4 = _mm_set1_ps(y);
+  const auto u4 = _mm_set1_ps(u);
+  const auto v4 = _mm_set1_ps(v);
+  for (std::size_t i = 0; i < _y.size(); i += 4)
+  {
+    const auto dy = _mm_sub_ps(y4, _mm_loadu_ps(&_y[i]));
+    const auto du = _mm_sub_ps(u4, _mm_loadu_ps(&_u[i]));
+    const auto dv = _mm_sub_ps(v4, _mm_loadu_ps(&_v[i]));
+    _mm_store_ps(distances + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(du, du)), _mm_mul_ps(dv, dv)));
+  }
+#else
+  for (std::size_t i = 0; i < _y.size(); ++i)
+  {
+    const auto dy = y - _y[i];
+    const auto du = u - _u[i];
+    const auto dv = v - _v[i];
+    distances[i] = (dy * dy + du * du) + dv * dv;
+  }
+#endif
+  return static_cast<uint8_t>(std::min_element(distances, distances + _palette.size()) - distances);
+}
+
+
+void CDitherer::GetNearestIndices(const float* r, const float* g, const float* b, uint8_t* indices) const
+{
+  // The pixels are processed together, each palette color being compared to all of them.
+  // Ties go to the lowest index.
+  const auto lumaRed = static_cast<float>(rgba8Bits_t::LUMA_RED);
+  const auto lumaGreen = static_cast<float>(rgba8Bits_t::LUMA_GREEN);
+  const auto lumaBlue = static_cast<float>(rgba8Bits_t::LUMA_BLUE);
+#if defined(__AVX2__)
+  const auto red = _mm256_loadu_ps(r);
+  const auto blue = _mm256_loadu_ps(b);
+  const auto y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(red, _mm256_set1_ps(lumaRed)), _mm256_mul_ps(_mm256_loadu_ps(g), _mm256_set1_ps(lumaGreen))),
+                               _mm256_mul_ps(blue, _mm256_set1_ps(lumaBlue)));
+  const auto u = _mm256_mul_ps(_mm256_set1_ps(0.492f), _mm256_sub_ps(blue, y));
+  const auto v = _mm256_mul_ps(_mm256_set1_ps(0.877f), _mm256_sub_ps(red, y));
+  auto best = _mm256_set1_ps(std::numeric_limits<float>::max());
+  auto bestIdx = _mm256_setzero_ps();
+  for (std::size_t k = 0; k < _palette.size(); ++k)
+  {
+    const auto dy = _mm256_sub_ps(y, _mm256_set1_ps(_y[k]));
+    const auto du = _mm256_sub_ps(u, _mm256_set1_ps(_u[k]));
+    const auto dv = _mm256_sub_ps(v, _mm256_set1_ps(_v[k]));
+    const auto distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(du, du)), _mm256_mul_ps(dv, dv));
+    const auto nearer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+    best = _mm256_blendv_ps(best, distance, nearer);
+    bestIdx = _mm256_blendv_ps(bestIdx, _mm256_set1_ps(static_cast<float>(k)), nearer);
+  }
+  alignas(32) int32_t found[BLOCK];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(found), _mm256_cvttps_epi32(bestIdx));
+  for (std::size_t i = 0; i < BLOCK; ++i) {
+    indices[i] = static_cast<uint8_t>(found[i]);
+  }
+#elif defined(DITHERER_SSE2)
+  for (std::size_t half = 0; half < BLOCK; half += 4)
+  {
+    const auto red = _mm_loadu_ps(r + half);
+    const auto blue = _mm_loadu_ps(b + half);
+    const auto y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(red, _mm_set1_ps(lumaRed)), _mm_mul_ps(_mm_loadu_ps(g + half), _mm_set1_ps(lumaGreen))),
+                              _mm_mul_ps(blue, _mm_set1_ps(lumaBlue)));
+    const auto u = _mm_mul_ps(_mm_set1_ps(0.492f), _mm_sub_ps(blue, y));
+    const auto v = _mm_mul_ps(_mm_set1_ps(0.877f), _mm_sub_ps(red, y));
+    auto best = _mm_set1_ps(std::numeric_limits<float>::max());
+    auto bestIdx = _mm_setzero_ps();
+    for (std::size_t k = 0; k < _palette.size(); ++k)
+    {
+      const auto dy = _mm_sub_ps(y, _mm_set1_ps(_y[k]));
+      const auto du = _mm_sub_ps(u, _mm_set1_ps(_u[k]));
+      const auto dv = _mm_sub_ps(v, _mm_set1_ps(_v[k]));
+      const auto distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(du, du)), _mm_mul_ps(dv, dv));
+      const auto nearer = _mm_cmplt_ps(distance, best);
+      best = _mm_or_ps(_mm_and_ps(nearer, distance), _mm_andnot_ps(nearer, best));
+      bestIdx = _mm_or_ps(_mm_and_ps(nearer, _mm_set1_ps(static_cast<float>(k))), _mm_andnot_ps(nearer, bestIdx));
+    }
+    alignas(16) int32_t found[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(found), _mm_cvttps_epi32(bestIdx));
+    for (std::size_t i = 0; i < 4; ++i) {
+      indices[half + i] = static_cast<uint8_t>(found[i]);
+    }
+  }
+#else
+  for (std::size_t i = 0; i < BLOCK; ++i)
+  {
+    const auto y = (r[i] * lumaRed + g[i] * lumaGreen) + b[i] * lumaBlue;
+    const auto u = 0.492f * (b[i] - y);
+    const auto v = 0.877f * (r[i] - y);
+    auto best = std::numeric_limits<float>::max();
+    uint8_t bestIdx = 0;
+    for (std::size_t k = 0; k < _palette.size(); ++k)
+    {
+      const auto dy = y - _y[k];
+      const auto du = u - _u[k];
+      const auto dv = v - _v[k];
+      const auto distance = (dy * dy + du * du) + dv * dv;
+      if (distance < best) {
+        best = distance;
+        bestIdx = static_cast<uint8_t>(k);
+      }
+    }
+    indices[i] = bestIdx;
+  }
+#endif
+}
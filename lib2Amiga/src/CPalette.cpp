@@ -19,12 +19,147 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <cmath>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PALETTE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "CError.h"
+#include "CThreadPool.h"
+#include "CColorTree.h"
+#include "CColorHistogram.h"
 #include "CPalette.h"
 
 //statics
 CPaletteFactory* CPaletteFactory::_Instance = nullptr;
 
+namespace
+{
+  const float FAR_AWAY = 1e6f;  //Padding of the palettes coordinates
+  const float TOLERANCE = 4.0f; //Twice the worst rounding of a distance in float
+
+  // Linear values of the sRGB levels
+  const std::vector<double>& LinearTable(void)
+  {
+    static const std::vector<double> table = []() {
+      std::vector<double> levels(256);
+      for (std::size_t i = 0; i < levels.size(); ++i) {
+        const auto level = i / 255.0;
+        levels[i] = level <= 0.04045 ? level / 12.92 : std::pow((level + 0.055) / 1.055, 2.4);
+      }
+      return levels;
+    }();
+    return table;
+  }
+
+  // sRGB to CIELAB, D65 white point
+  void ComputeLab(const rgba8Bits_t& color, double* lab)
+  {
+    const auto& linear = LinearTable();
+    const auto r = linear[color.r];
+    const auto g = linear[color.g];
+    const auto b = linear[color.b];
+    const double xyz[3] = {
+      (0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / 0.95047,
+      (0.2126729 * r + 0.7151522 * g + 0.0721750 * b),
+      (0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / 1.08883
+    };
+    double f[3];
+    for (int i = 0; i < 3; ++i) {
+      f[i] = xyz[i] > 216.0 / 24389.0 ? std::cbrt(xyz[i]) : (24389.0 / 27.0 * xyz[i] + 16.0) / 116.0;
+    }
+    lab[0] = 116.0 * f[1] - 16.0;
+    lab[1] = 500.0 * (f[0] - f[1]);
+    lab[2] = 200.0 * (f[1] - f[2]);
+  }
+
+  // CIELAB of the 4096 OCS colors
+  const std::vector<double>& OcsLabTable(void)
+  {
+    static const std::vector<double> table = []() {
+      std::vector<double> labs(3 * 4096);
+      for (unsigned int i = 0; i < 4096; ++i)
+      {
+        rgba8Bits_t color;
+        color.r = static_cast<uint8_t>(((i >> 8) & 0xF) * 17);
+        color.g = static_cast<uint8_t>(((i >> 4) & 0xF) * 17);
+        color.b = static_cast<uint8_t>((i & 0xF) * 17);
+        ComputeLab(color, &labs[3 * i]);
+      }
+      return labs;
+    }();
+    return table;
+  }
+
+  inline double Square(const double value) {
+    return value * value;
+  }
+
+  // Squared CIEDE2000 distance between two CIELAB colors (Sharma, Wu and Dalal's formulation)
+  double DeltaE2000Squared(const double* lab1, const double* lab2)
+  {
+    const auto PI = 3.14159265358979323846;
+    const auto POW25_7 = 6103515625.0;
+    const auto toRadians = PI / 180.0;
+
+    const auto meanC = (std::sqrt(Square(lab1[1]) + Square(lab1[2])) + std::sqrt(Square(lab2[1]) + Square(lab2[2]))) / 2.0;
+    const auto meanC7 = std::pow(meanC, 7.0);
+    const auto g = 0.5 * (1.0 - std::sqrt(meanC7 / (meanC7 + POW25_7)));
+    const auto a1 = (1.0 + g) * lab1[1];
+    const auto a2 = (1.0 + g) * lab2[1];
+    const auto c1 = std::sqrt(a1 * a1 + Square(lab1[2]));
+    const auto c2 = std::sqrt(a2 * a2 + Square(lab2[2]));
+    auto h1 = (a1 == 0.0 && lab1[2] == 0.0) ? 0.0 : std::atan2(lab1[2], a1) / toRadians;
+    auto h2 = (a2 == 0.0 && lab2[2] == 0.0) ? 0.0 : std::atan2(lab2[2], a2) / toRadians;
+    h1 += h1 < 0.0 ? 360.0 : 0.0;
+    h2 += h2 < 0.0 ? 360.0 : 0.0;
+
+    const auto deltaL = lab2[0] - lab1[0];
+    const auto deltaC = c2 - c1;
+    auto deltah = 0.0;
+    auto meanH = h1 + h2;
+    if (c1 * c2 != 0.0)
+    {
+      deltah = h2 - h1;
+      deltah += deltah > 180.0 ? -360.0 : (deltah < -180.0 ? 360.0 : 0.0);
+      if (std::abs(h1 - h2) <= 180.0) {
+        meanH = (h1 + h2) / 2.0;
+      }
+      else {
+        meanH = (h1 + h2 < 360.0) ? (h1 + h2 + 360.0) / 2.0 : (h1 + h2 - 360.0) / 2.0;
+      }
+    }
+    const auto deltaH = 2.0 * std::sqrt(c1 * c2) * std::sin(deltah / 2.0 * toRadians);
+
+    const auto meanL = (lab1[0] + lab2[0]) / 2.0;
+    const auto meanCp = (c1 + c2) / 2.0;
+    const auto meanCp7 = std::pow(meanCp, 7.0);
+    const auto t = 1.0 - 0.17 * std::cos((meanH - 30.0) * toRadians) + 0.24 * std::cos(2.0 * meanH * toRadians)
+                 + 0.32 * std::cos((3.0 * meanH + 6.0) * toRadians) - 0.20 * std::cos((4.0 * meanH - 63.0) * toRadians);
+    const auto deltaTheta = 30.0 * std::exp(-Square((meanH - 275.0) / 25.0));
+    const auto rc = 2.0 * std::sqrt(meanCp7 / (meanCp7 + POW25_7));
+    const auto sl = 1.0 + 0.015 * Square(meanL - 50.0) / std::sqrt(20.0 + Square(meanL - 50.0));
+    const auto sc = 1.0 + 0.045 * meanCp;
+    const auto sh = 1.0 + 0.015 * meanCp * t;
+    const auto rt = -std::sin(2.0 * deltaTheta * toRadians) * rc;
+
+    return Square(deltaL / sl) + Square(deltaC / sc) + Square(deltaH / sh) + rt * (deltaC / sc) * (deltaH / sh);
+  }
+
+  // Squared Euclidean distance, computed as rgba8Bits_t::Distance() for the YUV
+  inline double EuclideanSquared(const double* coords1, const double* coords2)
+  {
+    const auto d0 = coords1[0] - coords2[0];
+    const auto d1 = coords1[1] - coords2[1];
+    const auto d2 = coords1[2] - coords2[2];
+    return d0 * d0 + d1 * d1 + d2 * d2;
+  }
+}
+
 //+++++++++ CPALETTE ++++++++++++//
 CPalette::CPalette(const unordered_map<unsigned int, rgba8Bits_t>& colors)
 {
@@ -39,30 +174,280 @@ CPalette::CPalette(const std::vector<rgba8Bits_t >& colors)
   Sort();
 }
 
+CPalette::CPalette(const CPalette& other)
+  : std::vector<rgba8Bits_t>(other),
+    _search{ std::atomic_load(&other._search) },
+    _stamp{ other._stamp },
+    _metric{ other._metric }
+{   }
 
+CPalette& CPalette::operator=(const CPalette& other)
+{
+    std::vector<rgba8Bits_t>::operator=(other);
+    std::atomic_store(&_search, std::atomic_load(&other._search));
+    _stamp = other._stamp;
+    _metric = other._metric;
+    return *this;
+}
 
-rgba8Bits_t CPalette::GetNearestColor(const rgba8Bits_t& color) const
+uint64_t CPalette::NewStamp(void)
+{
+    static std::atomic<uint64_t> next{ 0 };
+    return next++;
+}
+
+
+
+void CPalette::GetCoordinates(const Metric metric, const rgba8Bits_t& color, double* coords)
+{
+    if (metric == Metric::YUV) {
+        // Same expressions as rgba8Bits_t::Distance()
+        coords[0] = rgba8Bits_t::LUMA_RED * color.r + rgba8Bits_t::LUMA_GREEN * color.g + rgba8Bits_t::LUMA_BLUE * color.b;
+        coords[1] = 0.492 * (color.b - coords[0]);
+        coords[2] = 0.877 * (color.r - coords[0]);
+    }
+    else if (color.r % 17 == 0 && color.g % 17 == 0 && color.b % 17 == 0) {
+        const auto lab = &OcsLabTable()[3 * (((color.r / 17) << 8) | ((color.g / 17) << 4) | (color.b / 17))];
+        std::copy(lab, lab + 3, coords);
+    }
+    else {
+        ComputeLab(color, coords);
+    }
+}
+
+double CPalette::Distance(const rgba8Bits_t& color1, const rgba8Bits_t& color2) const
 {
+    if (_metric == Metric::YUV) {
+        return color1.Distance(color2);
+    }
+    double coords1[3], coords2[3];
+    GetCoordinates(_metric, color1, coords1);
+    GetCoordinates(_metric, color2, coords2);
+    return _metric == Metric::CIELAB ? EuclideanSquared(coords1, coords2) : DeltaE2000Squared(coords1, coords2);
+}
+
+std::shared_ptr<CPalette::Search> CPalette::GetSearch(void) const
+{
+    auto search = std::atomic_load(&_search);
+    if (search == nullptr || search->metric != _metric || search->stamp != _stamp)
+    {
+        // concurrent callers may build their own: they are equivalent
+        search = std::make_shared<Search>();
+        search->metric = _metric;
+        search->stamp = _stamp;
+        if (_metric != Metric::CIEDE2000 && size() >= TREE_MIN_COLORS) {
+            search->tree.reset(new CColorTree(*this, _metric));
+            std::atomic_store(&_search, search);
+            return search;
+        }
+        search->coords.resize(3 * size());
+        for (std::size_t i = 0; i < size(); ++i) {
+            GetCoordinates(_metric, (*this)[i], &search->coords[3 * i]);
+        }
+        if (_metric != Metric::CIEDE2000)
+        {
+            const auto padded = (size() + LANES - 1) / LANES * LANES;
+            search->x.assign(padded, FAR_AWAY);
+            search->y.assign(padded, FAR_AWAY);
+            search->z.assign(padded, FAR_AWAY);
+            for (std::size_t i = 0; i < size(); ++i) {
+                search->x[i] = static_cast<float>(search->coords[3 * i]);
+                search->y[i] = static_cast<float>(search->coords[3 * i + 1]);
+                search->z[i] = static_cast<float>(search->coords[3 * i + 2]);
+            }
+        }
+        std::atomic_store(&_search, search);
+    }
+    return search;
+}
+
+std::size_t CPalette::SearchNearestIndex(const Search& search, const rgba8Bits_t& color, float* distances) const
+{
+    if (search.tree != nullptr) {
+        return search.tree->GetNearestIndex(color);
+    }
+    double coords[3];
+    GetCoordinates(search.metric, color, coords);
+    if (search.metric == Metric::CIEDE2000)
+    {
+        auto minDistance = std::numeric_limits<double>::max();
+        std::size_t found = 0;
+        for (std::size_t i = 0; i < size(); ++i)
+        {
+            const auto newDistance = DeltaE2000Squared(&search.coords[3 * i], coords);
+            if (newDistance < minDistance) {
+                minDistance = newDistance;
+                found = i;
+            }
+        }
+        return found;
+    }
+    const auto x = static_cast<float>(coords[0]);
+    const auto y = static_cast<float>(coords[1]);
+    const auto z = static_cast<float>(coords[2]);
+
+    // The distance is computed in the same order by all the kernels
+    const auto nbEntries = search.x.size();
+    auto nearest = std::numeric_limits<float>::max();
+#if defined(__AVX2__)
+    auto minimum = _mm256_set1_ps(nearest);
+    for (std::size_t i = 0; i < nbEntries; i += 8)
+    {
+        const auto dx = _mm256_sub_ps(_mm256_set1_ps(x), _mm256_loadu_ps(&search.x[i]));
+        const auto dy = _mm256_sub_ps(_mm256_set1_ps(y), _mm256_loadu_ps(&search.y[i]));
+        const auto dz = _mm256_sub_ps(_mm256_set1_ps(z), _mm256_loadu_ps(&search.z[i]));
+        const auto distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        _mm256_storeu_ps(distances + i, distance);
+        minimum = _mm256_min_ps(minimum, distance);
+    }
+    alignas(32) float minima[8];
+    _mm256_store_ps(minima, minimum);
+    nearest = *std::min_element(minima, minima + 8);
+#elif defined(PALETTE_SSE2)
+    auto minimum = _mm_set1_ps(nearest);
+    for (std::size_t i = 0; i < nbEntries; i += 4)
+    {
+        const auto dx = _mm_sub_ps(_mm_set1_ps(x), _mm_loadu_ps(&search.x[i]));
+        const auto dy = _mm_sub_ps(_mm_set1_ps(y), _mm_loadu_ps(&search.y[i]));
+        const auto dz = _mm_sub_ps(_mm_set1_ps(z), _mm_loadu_ps(&search.z[i]));
+        const auto distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        _mm_storeu_ps(distances + i, distance);
+        minimum = _mm_min_ps(minimum, distance);
+    }
+    alignas(16) float minima[4];
+    _mm_store_ps(minima, minimum);
+    nearest = *std::min_element(minima, minima + 4);
+#else
+    for (std::size_t i = 0; i < nbEntries; ++i)
+    {
+        const auto dx = x - search.x[i];
+        const auto dy = y - search.y[i];
+        const auto dz = z - search.z[i];
+        distances[i] = (dx * dx + dy * dy) + dz * dz;
+        nearest = std::min(nearest, distances[i]);
+    }
+#endif
+
+    // The candidates are settled in double, the first one winning the ties
+    const auto threshold = nearest + TOLERANCE;
     auto minDistance = std::numeric_limits<double>::max();
-    rgba8Bits_t colorFound;
-    for (auto colorInPalette : *this)
+    std::size_t found = 0;
+    for (std::size_t i = 0; i < size(); ++i)
     {
-        const auto newDistance = colorInPalette.Distance(color);
+        if (distances[i] > threshold) {
+            continue;
+        }
+        const auto newDistance = EuclideanSquared(&search.coords[3 * i], coords);
         if (newDistance < minDistance) {
             minDistance = newDistance;
-            colorFound = colorInPalette;
+            found = i;
+        }
+    }
+    return found;
+}
+
+void CPalette::SearchNearestIndices(const rgba8Bits_t* colors, const std::size_t count, uint32_t* indices) const
+{
+    if (empty()) {
+        throw CError("The palette is empty.");
+    }
+    const auto search = GetSearch();
+    const auto lookUp = [&](const std::size_t begin, const std::size_t end) {
+        std::vector<float> distances(search->x.size());
+        for (auto i = begin; i < end; ++i) {
+            indices[i] = static_cast<uint32_t>(SearchNearestIndex(*search, colors[i], distances.data()));
+        }
+    };
+
+    const std::size_t CHUNK = 1u << 12;
+    if (count <= CHUNK) {
+        lookUp(0, count);
+        return;
+    }
+    CThreadPool::GetInstance().ParallelFor((count + CHUNK - 1) / CHUNK, [&](const std::size_t chunk) {
+        lookUp(chunk * CHUNK, std::min(count, (chunk + 1) * CHUNK));
+    });
+}
+
+std::size_t CPalette::GetNearestIndex(const rgba8Bits_t& color) const
+{
+    if (empty()) {
+        throw CError("The palette is empty.");
+    }
+    const auto search = GetSearch();
+    thread_local std::vector<float> distances; // scratch buffer of the thread, reused by its queries
+    distances.resize(search->x.size());
+    return SearchNearestIndex(*search, color, distances.data());
+}
+
+void CPalette::GetNearestIndices(const rgba8Bits_t* colors, const std::size_t count, uint16_t* indices) const
+{
+    if (empty() || size() >= INVERSE_EMPTY) {
+        throw CError("The palette must have between 1 and 65534 colors.");
+    }
+    const auto search = GetSearch();
+    const std::size_t nbEntries = 1u << (3 * INVERSE_BITS);
+    std::call_once(search->inverseFlag, [&search, nbEntries]() {
+        search->inverse.reset(new std::atomic<uint16_t>[nbEntries]);
+        for (std::size_t i = 0; i < nbEntries; ++i) {
+            search->inverse[i].store(INVERSE_EMPTY, std::memory_order_relaxed);
+        }
+    });
+    const auto shift = 8 - INVERSE_BITS;
+    const auto mask = (1u << INVERSE_BITS) - 1;
+
+    // An entry is filled with the color of its key expanded to 8 bits by replicating its high bits,
+    // so that the first and last keys are black and white. Filled twice at worst, with the same index.
+    const auto lookUp = [&](const std::size_t begin, const std::size_t end) {
+        std::vector<float> distances(search->x.size());
+        for (auto i = begin; i < end; ++i)
+        {
+            const auto& color = colors[i];
+            const auto key = ((color.r >> shift) << (2 * INVERSE_BITS)) | ((color.g >> shift) << INVERSE_BITS) | (color.b >> shift);
+            auto& entry = search->inverse[key];
+            auto idx = entry.load(std::memory_order_relaxed);
+            if (idx == INVERSE_EMPTY)
+            {
+                rgba8Bits_t expanded;
+                expanded.r = static_cast<uint8_t>((((key >> (2 * INVERSE_BITS)) & mask) << shift) | (((key >> (2 * INVERSE_BITS)) & mask) >> (INVERSE_BITS - shift)));
+                expanded.g = static_cast<uint8_t>((((key >> INVERSE_BITS) & mask) << shift) | (((key >> INVERSE_BITS) & mask) >> (INVERSE_BITS - shift)));
+                expanded.b = static_cast<uint8_t>(((key & mask) << shift) | ((key & mask) >> (INVERSE_BITS - shift)));
+                idx = static_cast<uint16_t>(SearchNearestIndex(*search, expanded, distances.data()));
+                entry.store(idx, std::memory_order_relaxed);
+            }
+            indices[i] = idx;
         }
+    };
+
+    const std::size_t CHUNK = 1u << 16;
+    if (count <= CHUNK) {
+        lookUp(0, count);
+        return;
     }
-    return colorFound;
+    CThreadPool::GetInstance().ParallelFor((count + CHUNK - 1) / CHUNK, [&](const std::size_t chunk) {
+        lookUp(chunk * CHUNK, std::min(count, (chunk + 1) * CHUNK));
+    });
+}
+
+rgba8Bits_t CPalette::GetNearestColor(const rgba8Bits_t& color) const
+{
+    if (empty()) {
+        return rgba8Bits_t{};
+    }
+    return (*this)[GetNearestIndex(color)];
 }
 
 void CPalette::Sort()
 {
-  std::sort(this->begin(), this->end());
-  auto pLastColor = this->end() - 1;
+  _stamp = NewStamp();
+  std::sort(Colors::begin(), Colors::end());
+  if (this->size() < 2) {
+    return;
+  }
+  auto pLastColor = Colors::end() - 1;
   auto lightest = *pLastColor;
-  *pLastColor = (*this)[1];
-  (*this)[1] = lightest;
+  *pLastColor = Colors::operator[](1);
+  Colors::operator[](1) = lightest;
 }
 
 void CPalette::Save(const string& filename) const
@@ -147,20 +532,11 @@ const CPalette& CPaletteFactory::GetPalette(const string& key ) const
 
 CPalette CPaletteFactory::GetUniqueColors(Magick::Image& image) const
 {
-    std::unordered_map<unsigned int, rgba8Bits_t> uniqueColors;
-    PixelPacket* pixel = image.getPixels(0,0,image.size().width(), image.size().height());
-    
-    for (unsigned int i = 0; i < image.size().width() * image.size().height(); i++)
-    {
-        rgba8Bits_t color{ pixel->red, pixel->green, pixel->blue };
-        ++pixel;
-
-        //Add color if not present in unique colors colection
-        auto search = uniqueColors.find(color.Hash());
-        if (search == uniqueColors.end()) {
-            uniqueColors.insert({ color.Hash(), color });
-        }
-    }
+    CColorHistogram histogram;
+    histogram.Add(image);
+    std::vector<rgba8Bits_t> uniqueColors;
+    std::vector<uint64_t> counts;
+    histogram.GetColors(uniqueColors, counts);
 
     return CPalette{ uniqueColors };
 }
@@ -170,9 +546,14 @@ CPalette CPaletteFactory::GetUniqueColors(Magick::Image& image) const
 CPalette CPaletteFactory::MapPalette(const CPalette& palette, const CPalette& space) const
 {
     CPalette nearestColors;
-    
-    for (const auto& color : palette) {
-        nearestColors.push_back( space.GetNearestColor(color) );
+    if (palette.empty() || space.empty()) {
+        return nearestColors;
+    }
+
+    std::vector<uint32_t> indices(palette.size());
+    space.SearchNearestIndices(palette.data(), palette.size(), indices.data());
+    for (const auto idx : indices) {
+        nearestColors.push_back( space[idx] );
     }
 
     return nearestColors;
@@ -0,0 +1,279 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <unordered_map>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REFINER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "CError.h"
+#include "CThreadPool.h"
+#include "CPaletteRefiner.h"
+
+
+namespace
+{
+  struct Sum
+  {
+    uint64_t r = 0;
+    uint64_t g = 0;
+    uint64_t b = 0;
+    uint64_t weight = 0;
+  };
+
+  inline float Luma(const rgba8Bits_t& color) {
+    return static_cast<float>(rgba8Bits_t::LUMA_RED) * color.r + static_cast<float>(rgba8Bits_t::LUMA_GREEN) * color.g
+         + static_cast<float>(rgba8Bits_t::LUMA_BLUE) * color.b;
+  }
+}
+
+
+CPaletteRefiner::CPaletteRefiner(const CColorHistogram& histogram)
+{
+  // sorted, so that the points do not depend on the order of the insertions in the histogram
+  std::vector<std::pair<unsigned int, uint64_t>> counts;
+  counts.reserve(histogram.GetNbColors());
+  histogram.ForEach([&counts](const unsigned int color, const uint64_t count) { counts.emplace_back(color, count); });
+  std::sort(counts.begin(), counts.end());
+
+  const auto padded = (counts.size() + BLOCK - 1) / BLOCK * BLOCK;
+  _colors.reserve(counts.size());
+  _weights.reserve(counts.size());
+  _y.assign(padded, 0.0f);
+  _u.assign(padded, 0.0f);
+  _v.assign(padded, 0.0f);
+  for (std::size_t i = 0; i < counts.size(); ++i)
+  {
+    rgba8Bits_t color;
+    color.r = (counts[i].first >> 16) & 0xFF;
+    color.g = (counts[i].first >> 8) & 0xFF;
+    color.b = counts[i].first & 0xFF;
+    _colors.push_back(color);
+    _weights.push_back(counts[i].second);
+    _y[i] = Luma(color);
+    _u[i] = 0.492f * (color.b - _y[i]);
+    _v[i] = 0.877f * (color.r - _y[i]);
+  }
+}
+
+
+CPalette CPaletteRefiner::Refine(const CPalette& palette, const CPalette& space, const unsigned int maxIterations,
+                                 const unsigned int maxMilliseconds, const uint32_t seed) const
+{
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<rgba8Bits_t> centroids{ palette.begin(), palette.end() };
+  if (centroids.empty() || _colors.empty()) {
+    return palette;
+  }
+  if (centroids.size() > MAX_COLORS) {
+    throw CError("A palette of more than 65536 colors cannot be refined.");
+  }
+
+  auto& threadPool = CThreadPool::GetInstance();
+  const std::size_t nbChunks = threadPool.GetNbThreads();
+  const auto chunkSize = ((_colors.size() + nbChunks - 1) / nbChunks + BLOCK - 1) / BLOCK * BLOCK;
+  std::vector<uint16_t> clusters(_y.size());
+  std::vector<uint32_t> nearestColors; // nearest color of the space of each color, searched when a cluster first gets empty
+  std::mt19937_64 random{ seed };
+
+  for (auto iteration = 0u; iteration < maxIterations; ++iteration)
+  {
+    if (maxMilliseconds != 0 &&
+        std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(maxMilliseconds)) {
+      break;
+    }
+
+    std::vector<float> centroidsY, centroidsU, centroidsV;
+    for (const auto& centroid : centroids)
+    {
+      const auto y = Luma(centroid);
+      centroidsY.push_back(y);
+      centroidsU.push_back(0.492f * (centroid.b - y));
+      centroidsV.push_back(0.877f * (centroid.r - y));
+    }
+
+    // Assignment and accumulation: each chunk of colors has its own partial sums
+    std::vector<std::vector<Sum>> partialSums(nbChunks, std::vector<Sum>(centroids.size()));
+    threadPool.ParallelFor(nbChunks, [&](const std::size_t chunk)
+    {
+      const auto begin = std::min(chunk * chunkSize, _y.size());
+      const auto end = std::min(begin + chunkSize, _y.size());
+      Assign(centroidsY, centroidsU, centroidsV, begin, end, clusters.data());
+      auto& sums = partialSums[chunk];
+      for (auto i = begin; i < std::min(end, _colors.size()); ++i)
+      {
+        auto& sum = sums[clusters[i]];
+        sum.r += _colors[i].r * _weights[i];
+        sum.g += _colors[i].g * _weights[i];
+        sum.b += _colors[i].b * _weights[i];
+        sum.weight += _weights[i];
+      }
+    });
+
+    // Update: the centroids move to the mean of their colors, constrained to the space
+    bool changed = false;
+    std::vector<std::size_t> emptyClusters;
+    std::vector<std::size_t> filledClusters;
+    std::vector<rgba8Bits_t> means;
+    for (std::size_t k = 0; k < centroids.size(); ++k)
+    {
+      Sum sum;
+      for (const auto& sums : partialSums)
+      {
+        sum.r += sums[k].r;
+        sum.g += sums[k].g;
+        sum.b += sums[k].b;
+        sum.weight += sums[k].weight;
+      }
+      if (sum.weight == 0) {
+        emptyClusters.push_back(k);
+        continue;
+      }
+      rgba8Bits_t mean;
+      mean.r = static_cast<uint8_t>((sum.r + sum.weight / 2) / sum.weight);
+      mean.g = static_cast<uint8_t>((sum.g + sum.weight / 2) / sum.weight);
+      mean.b = static_cast<uint8_t>((sum.b + sum.weight / 2) / sum.weight);
+      filledClusters.push_back(k);
+      means.push_back(mean);
+    }
+    std::vector<uint32_t> snapped(means.size());
+    space.SearchNearestIndices(means.data(), means.size(), snapped.data());
+    for (std::size_t j = 0; j < filledClusters.size(); ++j)
+    {
+      auto& centroid = centroids[filledClusters[j]];
+      changed = changed || !(space[snapped[j]] == centroid);
+      centroid = space[snapped[j]];
+    }
+
+    // An empty cluster is moved to a color drawn proportionally to its weighted distance to its centroid
+    for (const auto k : emptyClusters)
+    {
+      std::vector<double> cumulated(_colors.size());
+      auto total = 0.0;
+      for (std::size_t i = 0; i < _colors.size(); ++i) {
+        total += _colors[i].Distance(centroids[clusters[i]]) * _weights[i];
+        cumulated[i] = total;
+      }
+      if (total <= 0.0) {
+        break; // every color is already a centroid
+      }
+      const auto target = (random() >> 11) * (1.0 / 9007199254740992.0) * total; // 53 bits in [0, 1[
+      const auto found = std::upper_bound(cumulated.begin(), cumulated.end(), target) - cumulated.begin();
+      const auto i = std::min<std::size_t>(static_cast<std::size_t>(found), _colors.size() - 1);
+      if (nearestColors.empty()) {
+        nearestColors.resize(_colors.size());
+        space.SearchNearestIndices(_colors.data(), _colors.size(), nearestColors.data());
+      }
+      centroids[k] = space[nearestColors[i]];
+      clusters[i] = static_cast<uint16_t>(k);
+      changed = true;
+    }
+
+    if (!changed) {
+      break;
+    }
+  }
+
+  std::unordered_map<unsigned int, rgba8Bits_t> colors;
+  for (const auto& centroid : centroids) {
+    colors.insert({ centroid.Hash(), centroid });
+  }
+  return CPalette{ colors };
+}
+
+
+void CPaletteRefiner::Assign(const std::vector<float>& centroidsY, const std::vector<float>& centroidsU, const std::vector<float>& centroidsV,
+                             const std::size_t begin, const std::size_t end, uint16_t* clusters) const
+{
+  // The distance is computed in the same order by all the kernels: ties go to the lowest index
+  const auto nbCentroids = centroidsY.size();
+#if defined(__AVX2__)
+  for (auto i = begin; i < end; i += BLOCK)
+  {
+    const auto y = _mm256_loadu_ps(&_y[i]);
+    const auto u = _mm256_loadu_ps(&_u[i]);
+    const auto v = _mm256_loadu_ps(&_v[i]);
+    auto best = _mm256_set1_ps(std::numeric_limits<float>::max());
+    auto bestIdx = _mm256_setzero_ps();
+    for (std::size_t k = 0; k < nbCentroids; ++k)
+    {
+      const auto dy = _mm256_sub_ps(y, _mm256_set1_ps(centroidsY[k]));
+      const auto du = _mm256_sub_ps(u, _mm256_set1_ps(centroidsU[k]));
+      const auto dv = _mm256_sub_ps(v, _mm256_set1_ps(centroidsV[k]));
+      const auto distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(du, du)), _mm256_mul_ps(dv, dv));
+      const auto nearer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+      best = _mm256_blendv_ps(best, distance, nearer);
+      bestIdx = _mm256_blendv_ps(bestIdx, _mm256_set1_ps(static_cast<float>(k)), nearer);
+    }
+    alignas(32) int32_t indices[BLOCK];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indices), _mm256_cvttps_epi32(bestIdx));
+    for (std::size_t j = 0; j < BLOCK; ++j) {
+      clusters[i + j] = static_cast<uint16_t>(indices[j]);
+    }
+  }
+#elif defined(REFINER_SSE2)
+  for (auto i = begin; i < end; i += 4)
+  {
+    const auto y = _mm_loadu_ps(&_y[i]);
+    const auto u = _mm_loadu_ps(&_u[i]);
+    const auto v = _mm_loadu_ps(&_v[i]);
+    auto best = _mm_set1_ps(std::numeric_limits<float>::max());
+    auto bestIdx = _mm_setzero_ps();
+    for (std::size_t k = 0; k < nbCentroids; ++k)
+    {
+      const auto dy = _mm_sub_ps(y, _mm_set1_ps(centroidsY[k]));
+      const auto du = _mm_sub_ps(u, _mm_set1_ps(centroidsU[k]));
+      const auto dv = _mm_sub_ps(v, _mm_set1_ps(centroidsV[k]));
+      const auto distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(du, du)), _mm_mul_ps(dv, dv));
+      const auto nearer = _mm_cmplt_ps(distance, best);
+      best = _mm_or_ps(_mm_and_ps(nearer, distance), _mm_andnot_ps(nearer, best));
+      bestIdx = _mm_or_ps(_mm_and_ps(nearer, _mm_set1_ps(static_cast<float>(k))), _mm_andnot_ps(nearer, bestIdx));
+    }
+    alignas(16) int32_t indices[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(bestIdx));
+    for (std::size_t j = 0; j < 4; ++j) {
+      clusters[i + j] = static_cast<uint16_t>(indices[j]);
+    }
+  }
+#else
+  for (auto i = begin; i < end; ++i)
+  {
+    auto best = std::numeric_limits<float>::max();
+    uint16_t bestIdx = 0;
+    for (std::size_t k = 0; k < nbCentroids; ++k)
+    {
+      const auto dy = _y[i] - centroidsY[k];
+      const auto du = _u[i] - centroidsU[k];
+      const auto dv = _v[i] - centroidsV[k];
+      const auto distance = (dy * dy + du * du) + dv * dv;
+      if (distance < best) {
+        best = distance;
+        bestIdx = static_cast<uint16_t>(k);
+      }
+    }
+    clusters[i] = bestIdx;
+  }
+#endif
+}
@@ -0,0 +1,293 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "CQuantizer.h"
+
+
+CQuantizer::CQuantizer(const CColorHistogram& histogram)
+  : _weights(SIDE * SIDE * SIDE, 0),
+    _momentsR(SIDE * SIDE * SIDE, 0),
+    _momentsG(SIDE * SIDE * SIDE, 0),
+    _momentsB(SIDE * SIDE * SIDE, 0),
+    _moments2(SIDE * SIDE * SIDE, 0.0)
+{
+  // Each color falls in the bin of its nearest OCS color
+  histogram.ForEach([this](const unsigned int hash, const uint64_t count)
+  {
+    const int64_t r = (hash >> 16) & 0xFF;
+    const int64_t g = (hash >> 8) & 0xFF;
+    const int64_t b = hash & 0xFF;
+    const auto idx = Index(static_cast<int>((r + 8) / 17) + 1, static_cast<int>((g + 8) / 17) + 1, static_cast<int>((b + 8) / 17) + 1);
+    const auto weight = static_cast<int64_t>(count);
+    _weights[idx] += weight;
+    _momentsR[idx] += r * weight;
+    _momentsG[idx] += g * weight;
+    _momentsB[idx] += b * weight;
+    _moments2[idx] += static_cast<double>(r * r + g * g + b * b) * weight;
+  });
+
+  // Cumulative moments: each cell sums the bins of the box [1, r]x[1, g]x[1, b]
+  for (int r = 1; r < SIDE; ++r)
+  {
+    int64_t areaW[SIDE] = {}, areaR[SIDE] = {}, areaG[SIDE] = {}, areaB[SIDE] = {};
+    double area2[SIDE] = {};
+    for (int g = 1; g < SIDE; ++g)
+    {
+      int64_t lineW = 0, lineR = 0, lineG = 0, lineB = 0;
+      double line2 = 0.0;
+      for (int b = 1; b < SIDE; ++b)
+      {
+        const auto idx = Index(r, g, b);
+        const auto prev = Index(r - 1, g, b);
+        lineW += _weights[idx];
+        lineR += _momentsR[idx];
+        lineG += _momentsG[idx];
+        lineB += _momentsB[idx];
+        line2 += _moments2[idx];
+        areaW[b] += lineW;
+        areaR[b] += lineR;
+        areaG[b] += lineG;
+        areaB[b] += lineB;
+        area2[b] += line2;
+        _weights[idx] = _weights[prev] + areaW[b];
+        _momentsR[idx] = _momentsR[prev] + areaR[b];
+        _momentsG[idx] = _momentsG[prev] + areaG[b];
+        _momentsB[idx] = _momentsB[prev] + areaB[b];
+        _moments2[idx] = _moments2[prev] + area2[b];
+      }
+    }
+  }
+}
+
+
+CPalette CQuantizer::Quantize(const CColorHistogram& histogram, const unsigned int nbColors, const CPalette& space)
+{
+  const CQuantizer quantizer(histogram);
+
+  std::vector<Box> boxes(std::max(1u, nbColors));
+  std::vector<double> variances(boxes.size(), 0.0);
+  boxes[0] = { 0, SIDE - 1, 0, SIDE - 1, 0, SIDE - 1, (SIDE - 1) * (SIDE - 1) * (SIDE - 1) };
+  std::size_t nbBoxes = 1;
+  std::size_t next = 0;
+  // Always split the box with the largest variance
+  while (nbBoxes < boxes.size())
+  {
+    if (quantizer.Cut(boxes[next], boxes[nbBoxes])) {
+      variances[next] = boxes[next].volume > 1 ? quantizer.Variance(boxes[next]) : 0.0;
+      variances[nbBoxes] = boxes[nbBoxes].volume > 1 ? quantizer.Variance(boxes[nbBoxes]) : 0.0;
+      ++nbBoxes;
+    }
+    else {
+      variances[next] = 0.0; // cannot be split
+    }
+    next = std::max_element(variances.begin(), variances.begin() + nbBoxes) - variances.begin();
+    if (variances[next] <= 0.0) {
+      break;
+    }
+  }
+
+  // The color of a box is the mean of its pixels, constrained to the space
+  std::vector<rgba8Bits_t> means;
+  for (std::size_t i = 0; i < nbBoxes; ++i)
+  {
+    const auto weight = Volume(boxes[i], quantizer._weights);
+    if (weight == 0) {
+      continue;
+    }
+    rgba8Bits_t mean;
+    mean.r = static_cast<uint8_t>((Volume(boxes[i], quantizer._momentsR) + weight / 2) / weight);
+    mean.g = static_cast<uint8_t>((Volume(boxes[i], quantizer._momentsG) + weight / 2) / weight);
+    mean.b = static_cast<uint8_t>((Volume(boxes[i], quantizer._momentsB) + weight / 2) / weight);
+    means.push_back(mean);
+  }
+  std::vector<uint32_t> nearest(means.size());
+  space.SearchNearestIndices(means.data(), means.size(), nearest.data());
+  std::unordered_map<unsigned int, rgba8Bits_t> colors;
+  for (const auto idx : nearest) {
+    colors.insert({ space[idx].Hash(), space[idx] });
+  }
+  return CPalette{ colors };
+}
+
+
+int64_t CQuantizer::Volume(const Box& box, const Moments& moments)
+{
+  return moments[Index(box.r1, box.g1, box.b1)]
+       - moments[Index(box.r1, box.g1, box.b0)]
+       - moments[Index(box.r1, box.g0, box.b1)]
+       + moments[Index(box.r1, box.g0, box.b0)]
+       - moments[Index(box.r0, box.g1, box.b1)]
+       + moments[Index(box.r0, box.g1, box.b0)]
+       + moments[Index(box.r0, box.g0, box.b1)]
+       - moments[Index(box.r0, box.g0, box.b0)];
+}
+
+
+// Part of Volume() not depending on the upper bound in the direction
+int64_t CQuantizer::Bottom(const Box& box, const Direction direction, const Moments& moments)
+{
+  switch (direction)
+  {
+  case RED:
+    return - moments[Index(box.r0, box.g1, box.b1)]
+           + moments[Index(box.r0, box.g1, box.b0)]
+           + moments[Index(box.r0, box.g0, box.b1)]
+           - moments[Index(box.r0, box.g0, box.b0)];
+  case GREEN:
+    return - moments[Index(box.r1, box.g0, box.b1)]
+           + moments[Index(box.r1, box.g0, box.b0)]
+           + moments[Index(box.r0, box.g0, box.b1)]
+           - moments[Index(box.r0, box.g0, box.b0)];
+  default:
+    return - moments[Index(box.r1, box.g1, box.b0)]
+           + moments[Index(box.r1, box.g0, box.b0)]
+           + moments[Index(box.r0, box.g1, box.b0)]
+           - moments[Index(box.r0, box.g0, box.b0)];
+  }
+}
+
+
+// Rest of Volume(), the upper bound in the direction being replaced by position
+int64_t CQuantizer::Top(const Box& box, const Direction direction, const int position, const Moments& moments)
+{
+  switch (direction)
+  {
+  case RED:
+    return moments[Index(position, box.g1, box.b1)]
+         - moments[Index(position, box.g1, box.b0)]
+         - moments[Index(position, box.g0, box.b1)]
+         + moments[Index(position, box.g0, box.b0)];
+  case GREEN:
+    return moments[Index(box.r1, position, box.b1)]
+         - moments[Index(box.r1, position, box.b0)]
+         - moments[Index(box.r0, position, box.b1)]
+         + moments[Index(box.r0, position, box.b0)];
+  default:
+    return moments[Index(box.r1, box.g1, position)]
+         - moments[Index(box.r1, box.g0, position)]
+         - moments[Index(box.r0, box.g1, position)]
+         + moments[Index(box.r0, box.g0, position)];
+  }
+}
+
+
+double CQuantizer::Variance(const Box& box) const
+{
+  const auto weight = Volume(box, _weights);
+  if (weight == 0) {
+    return 0.0;
+  }
+  const auto r = static_cast<double>(Volume(box, _momentsR));
+  const auto g = static_cast<double>(Volume(box, _momentsG));
+  const auto b = static_cast<double>(Volume(box, _momentsB));
+  const auto moment2 = _moments2[Index(box.r1, box.g1, box.b1)]
+                     - _moments2[Index(box.r1, box.g1, box.b0)]
+                     - _moments2[Index(box.r1, box.g0, box.b1)]
+                     + _moments2[Index(box.r1, box.g0, box.b0)]
+                     - _moments2[Index(box.r0, box.g1, box.b1)]
+                     + _moments2[Index(box.r0, box.g1, box.b0)]
+                     + _moments2[Index(box.r0, box.g0, box.b1)]
+                     - _moments2[Index(box.r0, box.g0, box.b0)];
+  return moment2 - (r * r + g * g + b * b) / weight;
+}
+
+
+// Returns the sum of r^2+g^2+b^2 / w of the two halves, to be maximized, and the position of the best cut
+double CQuantizer::Maximize(const Box& box, const Direction direction, const int first, const int last, int& cut,
+                            const int64_t wholeR, const int64_t wholeG, const int64_t wholeB, const int64_t wholeW) const
+{
+  const auto baseR = Bottom(box, direction, _momentsR);
+  const auto baseG = Bottom(box, direction, _momentsG);
+  const auto baseB = Bottom(box, direction, _momentsB);
+  const auto baseW = Bottom(box, direction, _weights);
+
+  auto max = 0.0;
+  cut = -1;
+  for (int i = first; i < last; ++i)
+  {
+    auto halfR = static_cast<double>(baseR + Top(box, direction, i, _momentsR));
+    auto halfG = static_cast<double>(baseG + Top(box, direction, i, _momentsG));
+    auto halfB = static_cast<double>(baseB + Top(box, direction, i, _momentsB));
+    auto halfW = baseW + Top(box, direction, i, _weights);
+    if (halfW == 0) { // never split into an empty box
+      continue;
+    }
+    auto value = (halfR * halfR + halfG * halfG + halfB * halfB) / halfW;
+
+    halfR = wholeR - halfR;
+    halfG = wholeG - halfG;
+    halfB = wholeB - halfB;
+    halfW = wholeW - halfW;
+    if (halfW == 0) {
+      continue;
+    }
+    value += (halfR * halfR + halfG * halfG + halfB * halfB) / halfW;
+
+    if (value > max) {
+      max = value;
+      cut = i;
+    }
+  }
+  return max;
+}
+
+
+// Splits box1 in two halves: box1 and box2. Returns false if it cannot be split.
+bool CQuantizer::Cut(Box& box1, Box& box2) const
+{
+  const auto wholeR = Volume(box1, _momentsR);
+  const auto wholeG = Volume(box1, _momentsG);
+  const auto wholeB = Volume(box1, _momentsB);
+  const auto wholeW = Volume(box1, _weights);
+
+  int cutR, cutG, cutB;
+  const auto maxR = Maximize(box1, RED, box1.r0 + 1, box1.r1, cutR, wholeR, wholeG, wholeB, wholeW);
+  const auto maxG = Maximize(box1, GREEN, box1.g0 + 1, box1.g1, cutG, wholeR, wholeG, wholeB, wholeW);
+  const auto maxB = Maximize(box1, BLUE, box1.b0 + 1, box1.b1, cutB, wholeR, wholeG, wholeB, wholeW);
+
+  box2.r1 = box1.r1;
+  box2.g1 = box1.g1;
+  box2.b1 = box1.b1;
+  if (maxR >= maxG && maxR >= maxB)
+  {
+    if (cutR < 0) {
+      return false;
+    }
+    box2.r0 = box1.r1 = cutR;
+    box2.g0 = box1.g0;
+    box2.b0 = box1.b0;
+  }
+  else if (maxG >= maxR && maxG >= maxB)
+  {
+    box2.g0 = box1.g1 = cutG;
+    box2.r0 = box1.r0;
+    box2.b0 = box1.b0;
+  }
+  else
+  {
+    box2.b0 = box1.b1 = cutB;
+    box2.r0 = box1.r0;
+    box2.g0 = box1.g0;
+  }
+
+  box1.volume = (box1.r1 - box1.r0) * (box1.g1 - box1.g0) * (box1.b1 - box1.b0);
+  box2.volume = (box2.r1 - box2.r0) * (box2.g1 - box2.g0) * (box2.b1 - box2.b0);
+  return true;
+}
@@ -0,0 +1,206 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+
+#include "CThreadPool.h"
+
+//statics
+CThreadPool* CThreadPool::_Instance = nullptr;
+unsigned int CThreadPool::_NbThreads = 1;
+
+namespace
+{
+  // Identifies the pool and queue owned by the current thread
+  thread_local const CThreadPool* CurrentPool = nullptr;
+  thread_local std::size_t CurrentQueue = 0;
+}
+
+
+void CThreadPool::SetNbThreads(const unsigned int nbThreads)
+{
+  _NbThreads = nbThreads;
+  delete _Instance;
+  _Instance = nullptr;
+}
+
+
+CThreadPool::CThreadPool(const unsigned int nbThreads)
+{
+  auto nbWorkers = nbThreads;
+  if (nbWorkers == 0) {
+    nbWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  --nbWorkers; // the calling thread works too
+
+  for (auto i = 0u; i <= nbWorkers; ++i) {
+    _queues.emplace_back(new Queue);
+  }
+  for (auto i = 0u; i < nbWorkers; ++i) {
+    _workers.emplace_back(&CThreadPool::WorkerLoop, this, i);
+  }
+}
+
+
+CThreadPool::~CThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_sleepMutex);
+    _stop = true;
+  }
+  _wakeUp.notify_all();
+  for (auto& worker : _workers) {
+    worker.join();
+  }
+}
+
+
+void CThreadPool::ParallelFor(const std::size_t count, const std::function<void(std::size_t)>& fct)
+{
+  if (count == 0) {
+    return;
+  }
+  if (_workers.empty() || count == 1) {
+    for (std::size_t i = 0; i < count; ++i) {
+      fct(i);
+    }
+    return;
+  }
+
+  struct Group
+  {
+    std::atomic<std::size_t> remaining;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    std::size_t errorIdx = std::numeric_limits<std::size_t>::max();
+  };
+  auto group = std::make_shared<Group>();
+  group->remaining = count;
+
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    Push([this, group, &fct, i]() {
+      try {
+        fct(i);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(group->errorMutex);
+        if (i < group->errorIdx) {
+          group->errorIdx = i;
+          group->error = std::current_exception();
+        }
+      }
+      if (--group->remaining == 0) {
+        // the waiting thread checks the group under the lock: the notification cannot be missed
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _wakeUp.notify_all();
+      }
+    });
+  }
+
+  // Help while waiting, then sleep until a task is pushed or the group is done
+  const auto queueIdx = GetQueueIndex();
+  while (group->remaining > 0)
+  {
+    if (TryRunOne(queueIdx)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_sleepMutex);
+    _wakeUp.wait(lock, [this, &group] { return group->remaining == 0 || _pending > 0; });
+  }
+
+  if (group->error) {
+    std::rethrow_exception(group->error);
+  }
+}
+
+
+std::size_t CThreadPool::GetQueueIndex(void)
+{
+  if (CurrentPool == this) {
+    return CurrentQueue;
+  }
+  return _queues.size() - 1;
+}
+
+
+void CThreadPool::Push(Task task)
+{
+  {
+    auto& queue = *_queues[GetQueueIndex()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(_sleepMutex);
+    ++_pending;
+  }
+  _wakeUp.notify_one();
+}
+
+
+bool CThreadPool::TryRunOne(const std::size_t queueIdx)
+{
+  Task task;
+  // own queue first, newest task
+  {
+    auto& queue = *_queues[queueIdx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+  }
+  // then steal the oldest task of another queue
+  for (std::size_t i = 1; !task && i < _queues.size(); ++i)
+  {
+    auto& queue = *_queues[(queueIdx + i) % _queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+  --_pending;
+  task();
+  return true;
+}
+
+
+void CThreadPool::WorkerLoop(const std::size_t queueIdx)
+{
+  CurrentPool = this;
+  CurrentQueue = queueIdx;
+
+  while (true)
+  {
+    if (TryRunOne(queueIdx)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_sleepMutex);
+    _wakeUp.wait(lock, [this] { return _stop || _pending > 0; });
+    if (_stop) {
+      return;
+    }
+  }
+}
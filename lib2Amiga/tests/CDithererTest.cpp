@@ -0,0 +1,131 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CThreadPool.h"
+#include "CPalette.h"
+#include "CDitherer.h"
+
+// Checks that the dithered indices are the same with one thread and with several ones:
+// error diffusion in raster and serpentine scans, ordered dithering and mixing plans.
+
+namespace
+{
+  const unsigned int NB_THREADS = 4;
+  const std::size_t NB_SIZES = 6;
+  const std::size_t SIZES[NB_SIZES][2] = {
+    { 1, 1 }, { 3, 5 }, { 17, 3 }, { 2, 40 }, { 64, 48 }, { 321, 200 }
+  };
+
+  // Random pixels over a gradient, so that the errors spread along the rows
+  Magick::Image GetImage(const std::size_t width, const std::size_t height)
+  {
+    std::vector<uint8_t> rgb(width * height * 3);
+    for (std::size_t i = 0; i < rgb.size(); ++i)
+    {
+      const auto x = (i / 3) % width;
+      const auto gradient = static_cast<int>(255 * x / width);
+      rgb[i] = static_cast<uint8_t>(std::min(std::max(gradient + std::rand() % 64 - 32, 0), 255));
+    }
+    return Magick::Image(width, height, "RGB", Magick::CharPixel, rgb.data());
+  }
+
+  CPalette GetPalette(const std::size_t size)
+  {
+    std::vector<rgba8Bits_t> colors(size);
+    for (auto& color : colors) {
+      color = rgba8Bits_t{ static_cast<uint8_t>(std::rand()), static_cast<uint8_t>(std::rand()), static_cast<uint8_t>(std::rand()) };
+    }
+    return CPalette{ colors };
+  }
+
+  // The ditherers are created for each run: the mixing plans are computed by the threads of the run
+  std::vector<std::pair<std::string, CDitherer>> GetDitherers(const CPalette& palette)
+  {
+    return {
+      { "Floyd-Steinberg raster", CDitherer{ palette, CDitherer::FLOYD_STEINBERG, false } },
+      { "Floyd-Steinberg serpentine", CDitherer{ palette, CDitherer::FLOYD_STEINBERG, true } },
+      { "Sierra Lite raster", CDitherer{ palette, CDitherer::SIERRA_LITE, false } },
+      { "Atkinson raster", CDitherer{ palette, CDitherer::ATKINSON, false } },
+      { "Atkinson serpentine", CDitherer{ palette, CDitherer::ATKINSON, true } },
+      { "Bayer 4x4", CDitherer{ palette, CDitherer::BAYER_4X4 } },
+      { "blue noise", CDitherer{ palette, CDitherer::BLUE_NOISE } },
+      { "mixing plans 8x8", CDitherer{ palette, CDitherer::BAYER_8X8, true } }
+    };
+  }
+
+  std::vector<std::vector<uint8_t>> Dither(const std::vector<Magick::Image>& images, const std::vector<CPalette>& palettes)
+  {
+    std::vector<std::vector<uint8_t>> results;
+    for (const auto& palette : palettes)
+    {
+      for (const auto& ditherer : GetDitherers(palette))
+      {
+        for (const auto& image : images)
+        {
+          results.emplace_back();
+          ditherer.second.Dither(image, results.back());
+        }
+      }
+    }
+    return results;
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  Magick::InitializeMagick(*argv);
+
+  std::vector<Magick::Image> images;
+  for (std::size_t i = 0; i < NB_SIZES; ++i) {
+    images.push_back(GetImage(SIZES[i][0], SIZES[i][1]));
+  }
+  const std::vector<CPalette> palettes = { GetPalette(2), GetPalette(16), GetPalette(32) };
+
+  CThreadPool::SetNbThreads(1);
+  const auto expected = Dither(images, palettes);
+  CThreadPool::SetNbThreads(NB_THREADS);
+  const auto results = Dither(images, palettes);
+
+  int status = EXIT_SUCCESS;
+  std::size_t n = 0;
+  for (const auto& palette : palettes)
+  {
+    for (const auto& ditherer : GetDitherers(palette))
+    {
+      for (std::size_t i = 0; i < NB_SIZES; ++i, ++n)
+      {
+        if (results[n] != expected[n])
+        {
+          std::cerr << "The " << ditherer.first << " indices of a " << SIZES[i][0] << "x" << SIZES[i][1] << " image and "
+                    << palette.size() << " colors differ with " << NB_THREADS << " threads!" << std::endl;
+          status = EXIT_FAILURE;
+        }
+      }
+    }
+  }
+  return status;
+}
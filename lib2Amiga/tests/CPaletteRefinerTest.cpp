@@ -0,0 +1,87 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CThreadPool.h"
+#include "CPalette.h"
+#include "CColorHistogram.h"
+#include "CPaletteRefiner.h"
+
+// Checks that a palette made of the colors of the image is kept by the refinement:
+// each color is its own cluster, whose mean is the color. The palettes are bigger than 256 colors.
+
+namespace
+{
+  const std::size_t NB_SIZES = 4;
+  const std::size_t SIZES[NB_SIZES] = { 2, 255, 300, 1000 };
+
+  // The colors ordered by their hash, as CPalette orders them by luma only
+  std::vector<unsigned int> GetHashes(const CPalette& palette)
+  {
+    std::vector<unsigned int> hashes;
+    for (const auto& color : palette) {
+      hashes.push_back(color.Hash());
+    }
+    std::sort(hashes.begin(), hashes.end());
+    return hashes;
+  }
+
+  // Distinct colors of the OCS, one per pixel
+  Magick::Image GetImage(const std::size_t nbColors, std::vector<rgba8Bits_t>& colors)
+  {
+    std::vector<uint8_t> rgb;
+    for (unsigned int i = 0; i < nbColors; ++i)
+    {
+      const auto ocs = i * 7 % 4096;
+      colors.emplace_back(static_cast<uint8_t>((ocs >> 8) * 0x11), static_cast<uint8_t>(((ocs >> 4) & 0xF) * 0x11), static_cast<uint8_t>((ocs & 0xF) * 0x11));
+      rgb.push_back(colors.back().r);
+      rgb.push_back(colors.back().g);
+      rgb.push_back(colors.back().b);
+    }
+    return Magick::Image(nbColors, 1, "RGB", Magick::CharPixel, rgb.data());
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  Magick::InitializeMagick(*argv);
+  CThreadPool::SetNbThreads(4);
+  const auto& space = CPaletteFactory::GetInstance().GetPalette("AMIGA");
+
+  int status = EXIT_SUCCESS;
+  for (const auto size : SIZES)
+  {
+    std::vector<rgba8Bits_t> colors;
+    CColorHistogram histogram;
+    histogram.Add(GetImage(size, colors));
+    const CPalette palette{ colors };
+    const auto refined = CPaletteRefiner{ histogram }.Refine(palette, space, 10, 0, 1);
+    if (GetHashes(refined) != GetHashes(palette))
+    {
+      std::cerr << "The refinement moves a palette of " << size << " colors made of the colors of the image!" << std::endl;
+      status = EXIT_FAILURE;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,153 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CPalette.h"
+
+// Checks the nearest color searches against the distances to all the colors of the palette:
+// the small palettes are searched by the SIMD kernels, the big ones in a CColorTree.
+
+namespace
+{
+  const std::size_t NB_SIZES = 10;
+  const std::size_t SIZES[NB_SIZES] = { 1, 2, 3, 16, 32, 100, 256, 511, 512, 1000 };
+  // CIEDE2000 is searched by computing all the distances, as the reference
+  const std::size_t NB_METRICS = 2;
+  const CPalette::Metric METRICS[NB_METRICS] = { CPalette::Metric::YUV, CPalette::Metric::CIELAB };
+  const char* const METRIC_NAMES[NB_METRICS] = { "YUV", "CIELAB" };
+  const std::size_t NB_COLORS = 2000;
+
+  rgba8Bits_t GetRandomColor(void)
+  {
+    return rgba8Bits_t{ static_cast<uint8_t>(std::rand()), static_cast<uint8_t>(std::rand()), static_cast<uint8_t>(std::rand()) };
+  }
+
+  // The 4096 colors of the OCS, 0xRGB being 0xRRGGBB
+  CPalette GetOCSPalette(void)
+  {
+    std::vector<rgba8Bits_t> colors;
+    for (unsigned int rgb = 0; rgb < 4096; ++rgb) {
+      colors.emplace_back(static_cast<uint8_t>((rgb >> 8) * 0x11), static_cast<uint8_t>(((rgb >> 4) & 0xF) * 0x11), static_cast<uint8_t>((rgb & 0xF) * 0x11));
+    }
+    return CPalette{ colors };
+  }
+
+  CPalette GetRandomPalette(const std::size_t size)
+  {
+    std::vector<rgba8Bits_t> colors(size);
+    for (auto& color : colors) {
+      color = GetRandomColor();
+    }
+    // Some duplicates, the first of them must be found
+    for (std::size_t i = 3; i < size; i += 7) {
+      colors[i] = colors[i / 2];
+    }
+    return CPalette{ colors };
+  }
+
+  // Index of the nearest color, the first one winning ties
+  std::size_t GetNearestIndex(const CPalette& palette, const rgba8Bits_t& color)
+  {
+    std::size_t nearest = 0;
+    auto best = palette.Distance(color, palette[0]);
+    for (std::size_t i = 1; i < palette.size(); ++i)
+    {
+      const auto distance = palette.Distance(color, palette[i]);
+      if (distance < best) {
+        best = distance;
+        nearest = i;
+      }
+    }
+    return nearest;
+  }
+
+  int CheckSearch(CPalette palette, const std::string& description, const std::vector<rgba8Bits_t>& colors)
+  {
+    int status = EXIT_SUCCESS;
+    for (std::size_t m = 0; m < NB_METRICS; ++m)
+    {
+      palette.SetMetric(METRICS[m]);
+      std::vector<uint32_t> indices(colors.size());
+      palette.SearchNearestIndices(colors.data(), colors.size(), indices.data());
+      std::size_t nbErrors = 0;
+      for (std::size_t i = 0; i < colors.size(); ++i)
+      {
+        const auto expected = GetNearestIndex(palette, colors[i]);
+        if (indices[i] != expected || palette.GetNearestIndex(colors[i]) != expected) {
+          ++nbErrors;
+        }
+      }
+      if (nbErrors != 0)
+      {
+        std::cerr << nbErrors << " colors out of " << colors.size() << " are not mapped to their nearest in the "
+                  << description << " in " << METRIC_NAMES[m] << "!" << std::endl;
+        status = EXIT_FAILURE;
+      }
+    }
+    return status;
+  }
+
+  // The searches after a change of the colors must see the new ones, and only in the changed copy
+  int CheckChanges(const std::size_t size)
+  {
+    const rgba8Bits_t added{ static_cast<uint8_t>(1), static_cast<uint8_t>(2), static_cast<uint8_t>(3) };
+    CPalette palette = GetRandomPalette(size);
+    palette.GetNearestIndex(added);
+    const CPalette copy = palette;
+    palette.push_back(added);
+    int status = EXIT_SUCCESS;
+    if (palette.GetNearestIndex(added) != size || copy.GetNearestIndex(added) != GetNearestIndex(copy, added))
+    {
+      std::cerr << "The search of a palette of " << size << " colors ignores an added color!" << std::endl;
+      status = EXIT_FAILURE;
+    }
+    palette.clear();
+    palette.push_back(added);
+    if (palette.GetNearestIndex(rgba8Bits_t{}) != 0)
+    {
+      std::cerr << "The search of a palette of " << size << " colors ignores its clearing!" << std::endl;
+      status = EXIT_FAILURE;
+    }
+    return status;
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  Magick::InitializeMagick(*argv);
+
+  // Random colors, and the colors of the OCS, nearest to themselves
+  const auto ocs = GetOCSPalette();
+  std::vector<rgba8Bits_t> colors(ocs.begin(), ocs.end());
+  for (std::size_t i = 0; i < NB_COLORS; ++i) {
+    colors.push_back(GetRandomColor());
+  }
+
+  int status = CheckSearch(ocs, "4096 colors of the OCS", colors);
+  for (std::size_t i = 0; i < NB_SIZES; ++i) {
+    status |= CheckSearch(GetRandomPalette(SIZES[i]), "palette of " + std::to_string(SIZES[i]) + " random colors", colors);
+    status |= CheckChanges(SIZES[i]);
+  }
+  return status;
+}
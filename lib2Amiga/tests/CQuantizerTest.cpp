@@ -0,0 +1,182 @@
+/*
+*  Copyright (C) 2014-2021 Christophe Meneboeuf <christophe@xtof.info>
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "CPalette.h"
+#include "CColorHistogram.h"
+#include "CChunkyImage.h"
+
+// Checks the palettes of Wu's quantizer. Invoked as "CQuantizerTest benchmark [image...]",
+// it also reports the time and the mean distance of the palettes of both quantizers, as --stats,
+// on the images or, if none is given, on synthetic ones.
+
+namespace
+{
+  const std::size_t NB_RUNS = 5;  //The best time is reported
+
+  struct Input
+  {
+    std::string name;
+    Magick::Image image;
+  };
+
+  // Smooth gradients, sums of waves of several frequencies, or a gradient with noise
+  enum Pattern { GRADIENT, WAVES, NOISE };
+
+  Magick::Image GetImage(const std::size_t width, const std::size_t height, const Pattern pattern)
+  {
+    std::vector<uint8_t> rgb(width * height * 3);
+    for (std::size_t y = 0; y < height; ++y)
+    {
+      for (std::size_t x = 0; x < width; ++x)
+      {
+        uint8_t* pixel = &rgb[(y * width + x) * 3];
+        const auto fx = static_cast<double>(x) / width;
+        const auto fy = static_cast<double>(y) / height;
+        for (int c = 0; c < 3; ++c)
+        {
+          double value;
+          if (pattern == GRADIENT) {
+            value = c == 0 ? fx : c == 1 ? fy : (1.0 - fx) * fy;
+          }
+          else if (pattern == WAVES) {
+            value = 0.5 + 0.2 * std::sin(6 * fx + 2 * c) + 0.15 * std::sin(11 * fy + 3 * c + 4 * fx)
+                  + 0.1 * std::sin(37 * (fx + fy) + c) + 0.05 * std::sin(101 * fx * fy + c);
+          }
+          else {
+            value = (c == 0 ? fx : c == 1 ? fy : 0.5 * (fx + fy)) + (std::rand() % 41 - 20) / 255.0;
+          }
+          pixel[c] = static_cast<uint8_t>(std::min(std::max(255.0 * value, 0.0), 255.0));
+        }
+      }
+    }
+    return Magick::Image(width, height, "RGB", Magick::CharPixel, rgb.data());
+  }
+
+  std::vector<Input> GetSyntheticInputs(void)
+  {
+    std::vector<Input> inputs;
+    const std::size_t sizes[2][2] = { { 320, 256 }, { 1920, 1080 } };
+    const char* const names[3] = { "gradient", "waves", "noisy gradient" };
+    for (const auto& size : sizes)
+    {
+      for (int pattern = GRADIENT; pattern <= NOISE; ++pattern) {
+        inputs.push_back({ std::to_string(size[0]) + "x" + std::to_string(size[1]) + " " + names[pattern],
+                           GetImage(size[0], size[1], static_cast<Pattern>(pattern)) });
+      }
+    }
+    return inputs;
+  }
+
+  int CheckPalette(const Input& input, const unsigned int nbColors, const CPalette& space)
+  {
+    CChunkyImageFactory factory;
+    factory.Init(input.image, nbColors, false, space);
+    const auto& palette = factory.GetPalette();
+    if (palette.empty() || palette.size() > nbColors)
+    {
+      std::cerr << "The palette of the " << input.name << " image has " << palette.size() << " colors instead of at most " << nbColors << "!" << std::endl;
+      return EXIT_FAILURE;
+    }
+    for (const auto& color : palette)
+    {
+      if (!(space.GetNearestColor(color) == color))
+      {
+        std::cerr << "The palette of the " << input.name << " image has colors out of the space!" << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // The time spent by Init() and the mean distance between the pixels and the palette
+  void Benchmark(const Input& input, const unsigned int nbColors, const CPalette& space)
+  {
+    CColorHistogram histogram;
+    histogram.Add(input.image);
+    std::printf("%-28s %8zu colors -> %2u:", input.name.c_str(), histogram.GetNbColors(), nbColors);
+    const CChunkyImageFactory::Quantizer quantizers[2] = { CChunkyImageFactory::Quantizer::WU, CChunkyImageFactory::Quantizer::MAGICK };
+    const char* const names[2] = { "wu", "magick" };
+    for (int q = 0; q < 2; ++q)
+    {
+      try
+      {
+        auto best = std::numeric_limits<double>::max();
+        CChunkyImageFactory factory;
+        factory.SetQuantizer(quantizers[q]);
+        for (std::size_t run = 0; run < NB_RUNS; ++run)
+        {
+          const auto start = std::chrono::steady_clock::now();
+          factory.Init(input.image, nbColors, false, space);
+          const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+          best = std::min(best, duration.count());
+        }
+        std::printf("  %s %8.2f ms, mean distance %6.2f", names[q], best, histogram.GetMeanError(factory.GetPalette()));
+      }
+      catch (const std::exception& e) {
+        std::printf("  %s failed: %s", names[q], e.what());
+      }
+    }
+    std::printf("\n");
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  Magick::InitializeMagick(*argv);
+  const auto& space = CPaletteFactory::GetInstance().GetPalette("AMIGA");
+  const unsigned int nbColors[3] = { 2, 16, 32 };
+
+  int status = EXIT_SUCCESS;
+  const auto synthetic = GetSyntheticInputs();
+  for (const auto& input : synthetic)
+  {
+    for (const auto n : nbColors) {
+      status |= CheckPalette(input, n, space);
+    }
+  }
+
+  if (argc > 1 && std::strcmp(argv[1], "benchmark") == 0)
+  {
+    std::vector<Input> inputs;
+    for (int i = 2; i < argc; ++i) {
+      inputs.push_back({ argv[i], Magick::Image(argv[i]) });
+    }
+    for (const auto& input : inputs.empty() ? synthetic : inputs)
+    {
+      for (const auto n : { 16u, 32u }) {
+        Benchmark(input, n, space);
+      }
+    }
+  }
+
+  return status;
+}
@@ -3,6 +3,13 @@
 #include <string.h>
 #include "viewportmode.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AMIVIDEO_SSE2
+#include <emmintrin.h>
+#endif
+
 #define TRUE 1
 #define FALSE 0
 
@@ -168,7 +175,7 @@ void amiVideo_setScreenCorrectedPixelsPointer(amiVideo_Screen *screen, void *pix
     }
 }
 
-static void convertScreenBitplanesToTarget(amiVideo_Screen *screen, int chunky)
+static void convertScreenTrueColorBitplanesToRGBPixels(amiVideo_Screen *screen)
 {
     unsigned int i;
     
@@ -197,12 +204,8 @@ static void convertScreenBitplanesToTarget(amiVideo_Screen *screen, int chunky)
 		    if(pixelCount < screen->width) /* We must skip the padding bits. If we have already converted sufficient pixels on this scanline, ignore the rest */
 		    {
 			if(bitplane & bitmask)
-			{
-			    if(chunky)
-			        screen->uncorrectedChunkyFormat.pixels[count] |= indexBit;
-			    else
-			        screen->uncorrectedRGBFormat.pixels[count] |= indexBit;
-			}
+			    screen->uncorrectedRGBFormat.pixels[count] |= indexBit;
+			
 			count++;
 		    }
 		    
@@ -214,19 +217,189 @@ static void convertScreenBitplanesToTarget(amiVideo_Screen *screen, int chunky)
 	    }
 	    
 	    /* Skip the padding bytes in the output */
-	    if(chunky)
-	        count += screen->uncorrectedChunkyFormat.pitch - screen->width; 
-	    else
-	        count += screen->uncorrectedRGBFormat.pitch / 4 - screen->width; 
+	    count += screen->uncorrectedRGBFormat.pitch / 4 - screen->width; 
 	    
 	    vOffset += screen->bitplaneFormat.pitch;
 	}
     }
 }
 
+/*
+ * Planar to chunky conversion. Each scan line of the bitplanes is converted
+ * in a single pass into a scan line of chunky pixels, the bytes of all the
+ * bitplanes at the same offset making 8 pixels.
+ */
+
+typedef void (*p2cFunction)(amiVideo_UByte **bitplanes, unsigned int offset, amiVideo_UByte *pixels, unsigned int width);
+
+/* Converts the byte at offset of each bitplane into 8 pixels, as a transposition of an 8x8 bit matrix */
+static void p2cByte(amiVideo_UByte **bitplanes, unsigned int offset, amiVideo_UByte *pixels, unsigned int bitplaneDepth)
+{
+    amiVideo_UByte bytes[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    amiVideo_ULong x, y, t;
+    unsigned int i;
+    
+    for(i = 0; i < bitplaneDepth; i++)
+        bytes[i] = bitplanes[i][offset];
+    
+    x = ((amiVideo_ULong)bytes[7] << 24) | ((amiVideo_ULong)bytes[6] << 16) | ((amiVideo_ULong)bytes[5] << 8) | bytes[4];
+    y = ((amiVideo_ULong)bytes[3] << 24) | ((amiVideo_ULong)bytes[2] << 16) | ((amiVideo_ULong)bytes[1] << 8) | bytes[0];
+    
+    t = (x ^ (x >> 7)) & 0x00AA00AA; x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA; y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+    
+    /* The pixels are now the bytes of x:y, the first one being the most significant */
+    pixels[0] = (amiVideo_UByte)(x >> 24);
+    pixels[1] = (amiVideo_UByte)(x >> 16);
+    pixels[2] = (amiVideo_UByte)(x >> 8);
+    pixels[3] = (amiVideo_UByte)x;
+    pixels[4] = (amiVideo_UByte)(y >> 24);
+    pixels[5] = (amiVideo_UByte)(y >> 16);
+    pixels[6] = (amiVideo_UByte)(y >> 8);
+    pixels[7] = (amiVideo_UByte)y;
+}
+
+#if defined(__AVX2__)
+/* Returns the 32 bits at offset of a bitplane, the first 8 pixels in the low byte, or 0 past the bitplane depth */
+static amiVideo_ULong p2cLong(amiVideo_UByte **bitplanes, unsigned int offset, unsigned int bitplane, unsigned int bitplaneDepth)
+{
+    if(bitplane < bitplaneDepth)
+    {
+        const amiVideo_UByte *bytes = bitplanes[bitplane] + offset;
+        return bytes[0] | (bytes[1] << 8) | ((amiVideo_ULong)bytes[2] << 16) | ((amiVideo_ULong)bytes[3] << 24);
+    }
+    else
+        return 0;
+}
+#endif
+
+#if defined(__AVX2__) || defined(AMIVIDEO_SSE2)
+/* Returns the 16 bits at offset of a bitplane, the first 8 pixels in the low byte, or 0 past the bitplane depth */
+static int p2cWord(amiVideo_UByte **bitplanes, unsigned int offset, unsigned int bitplane, unsigned int bitplaneDepth)
+{
+    return bitplane < bitplaneDepth ? bitplanes[bitplane][offset] | (bitplanes[bitplane][offset + 1] << 8) : 0;
+}
+
+/*
+ * Transposes the 8x8 bit matrices of the 64-bit lanes, the most significant
+ * byte being the first row, with the same steps as the 32-bit version.
+ */
+#define P2C_TRANSPOSE(prefix, bits, x) \
+{ \
+    __m##bits##i t = prefix##_and_si##bits(prefix##_xor_si##bits(x, prefix##_srli_epi64(x, 7)), prefix##_set1_epi32(0x00AA00AA)); \
+    x = prefix##_xor_si##bits(x, prefix##_xor_si##bits(t, prefix##_slli_epi64(t, 7))); \
+    t = prefix##_and_si##bits(prefix##_xor_si##bits(x, prefix##_srli_epi64(x, 14)), prefix##_set1_epi32(0x0000CCCC)); \
+    x = prefix##_xor_si##bits(x, prefix##_xor_si##bits(t, prefix##_slli_epi64(t, 14))); \
+    t = prefix##_and_si##bits(prefix##_xor_si##bits(x, prefix##_srli_epi64(x, 28)), prefix##_set1_epi64x(0xF0F0F0F0)); \
+    x = prefix##_xor_si##bits(x, prefix##_xor_si##bits(t, prefix##_slli_epi64(t, 28))); \
+}
+#endif
+
+/* Converts a scan line of width pixels starting at offset in the bitplanes, several bytes at a time when SIMD instructions are available */
+static void p2cScanLine(amiVideo_UByte **bitplanes, unsigned int offset, amiVideo_UByte *pixels, unsigned int width, unsigned int bitplaneDepth)
+{
+    unsigned int i = 0;
+#if defined(__AVX2__)
+    /* Groups the bytes of each bitplane, 4 bitplanes per lane, by offset and then the offsets in 64-bit lanes */
+    const __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                           0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    
+    for(; i + 32 <= width; i += 32)
+    {
+        unsigned int byteOffset = offset + i / 8;
+        __m256i planar = _mm256_setr_epi32((int)p2cLong(bitplanes, byteOffset, 0, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 1, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 2, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 3, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 4, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 5, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 6, bitplaneDepth),
+                                           (int)p2cLong(bitplanes, byteOffset, 7, bitplaneDepth));
+        
+        planar = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(planar, group), interleave);
+        P2C_TRANSPOSE(_mm256, 256, planar)
+        _mm256_storeu_si256((__m256i*)(pixels + i), _mm256_shuffle_epi8(planar, reverse));
+    }
+#endif
+#if defined(__AVX2__) || defined(AMIVIDEO_SSE2)
+    for(; i + 16 <= width; i += 16)
+    {
+        unsigned int byteOffset = offset + i / 8;
+        __m128i words = _mm_setr_epi16((short)p2cWord(bitplanes, byteOffset, 0, bitplaneDepth), (short)p2cWord(bitplanes, byteOffset, 1, bitplaneDepth),
+                                       (short)p2cWord(bitplanes, byteOffset, 2, bitplaneDepth), (short)p2cWord(bitplanes, byteOffset, 3, bitplaneDepth),
+                                       (short)p2cWord(bitplanes, byteOffset, 4, bitplaneDepth), (short)p2cWord(bitplanes, byteOffset, 5, bitplaneDepth),
+                                       (short)p2cWord(bitplanes, byteOffset, 6, bitplaneDepth), (short)p2cWord(bitplanes, byteOffset, 7, bitplaneDepth));
+        /* The first bytes of the words in the low lane, the second ones in the high lane, the first bitplane being the least significant byte */
+        __m128i planar = _mm_packus_epi16(_mm_and_si128(words, _mm_set1_epi16(0xFF)), _mm_srli_epi16(words, 8));
+        
+        P2C_TRANSPOSE(_mm, 128, planar)
+        
+        /* The bytes are reversed, so that the first pixel, in the most significant byte of a lane, is written first */
+        planar = _mm_shufflehi_epi16(_mm_shufflelo_epi16(planar, 0x1B), 0x1B);
+        planar = _mm_or_si128(_mm_slli_epi16(planar, 8), _mm_srli_epi16(planar, 8));
+        _mm_storeu_si128((__m128i*)(pixels + i), planar);
+    }
+#endif
+    for(; i + 8 <= width; i += 8)
+        p2cByte(bitplanes, offset + i / 8, pixels + i, bitplaneDepth);
+    
+    /* The padding bits of the last byte are not converted */
+    if(i < width)
+    {
+        amiVideo_UByte lastPixels[8];
+        
+        p2cByte(bitplanes, offset + i / 8, lastPixels, bitplaneDepth);
+        memcpy(pixels + i, lastPixels, width - i);
+    }
+}
+
+/* Variants for each depth, the depth being a constant for the compiler */
+#define P2C_VARIANT(depth) \
+static void p2cDepth##depth(amiVideo_UByte **bitplanes, unsigned int offset, amiVideo_UByte *pixels, unsigned int width) \
+{ \
+    p2cScanLine(bitplanes, offset, pixels, width, depth); \
+}
+
+P2C_VARIANT(1)
+P2C_VARIANT(2)
+P2C_VARIANT(3)
+P2C_VARIANT(4)
+P2C_VARIANT(5)
+P2C_VARIANT(6)
+P2C_VARIANT(7)
+P2C_VARIANT(8)
+
+static const p2cFunction p2cFunctions[] = { NULL, p2cDepth1, p2cDepth2, p2cDepth3, p2cDepth4, p2cDepth5, p2cDepth6, p2cDepth7, p2cDepth8 };
+
+/* Returns the conversion of a scan line for the depth of the screen, chunky pixels having at most 8 bits */
+static p2cFunction selectP2CFunction(const amiVideo_Screen *screen)
+{
+    return p2cFunctions[screen->bitplaneDepth > 8 ? 8 : screen->bitplaneDepth];
+}
+
+static void convertScreenBitplaneScanLinesToChunkyPixels(amiVideo_Screen *screen, unsigned int firstScanLine, unsigned int numOfScanLines)
+{
+    p2cFunction p2c = selectP2CFunction(screen);
+    unsigned int i;
+    
+    if(p2c == NULL)
+        return;
+    
+    for(i = firstScanLine; i < firstScanLine + numOfScanLines; i++)
+        p2c(screen->bitplaneFormat.bitplanes, i * screen->bitplaneFormat.pitch, screen->uncorrectedChunkyFormat.pixels + i * screen->uncorrectedChunkyFormat.pitch, screen->width);
+}
+
 void amiVideo_convertScreenBitplanesToChunkyPixels(amiVideo_Screen *screen)
 {
-    convertScreenBitplanesToTarget(screen, TRUE);
+    convertScreenBitplaneScanLinesToChunkyPixels(screen, 0, screen->height);
 }
 
 static amiVideo_ULong convertColorToRGBPixel(const amiVideo_OutputColor *color, amiVideo_UByte rshift, amiVideo_UByte gshift, amiVideo_UByte bshift, amiVideo_UByte ashift)
@@ -234,92 +407,515 @@ static amiVideo_ULong convertColorToRGBPixel(const amiVideo_OutputColor *color,
     return (color->r << rshift) | (color->g << gshift) | (color->b << bshift) | (color->a << ashift);
 }
 
-void amiVideo_convertScreenChunkyPixelsToRGBPixels(amiVideo_Screen *screen)
+/* Computes the RGB pixels of the 256 possible chunky pixels, those out of the palette being black */
+static void convertPaletteToRGBPixels(const amiVideo_Screen *screen, amiVideo_ULong *rgbPixels)
 {
-    unsigned int screenWidthInPixels = screen->uncorrectedRGBFormat.pitch / 4;
+    unsigned int i;
+    
+    for(i = 0; i < 256; i++)
+    {
+        if(i < screen->palette.chunkyFormat.numOfColors)
+            rgbPixels[i] = convertColorToRGBPixel(&screen->palette.chunkyFormat.color[i], screen->uncorrectedRGBFormat.rshift, screen->uncorrectedRGBFormat.gshift, screen->uncorrectedRGBFormat.bshift, screen->uncorrectedRGBFormat.ashift);
+        else
+            rgbPixels[i] = 0;
+    }
+}
+
+/* Converts a scan line of chunky pixels starting at offset to RGB pixels, using the RGB pixels of the palette in normal mode */
+static void convertScanLineChunkyPixelsToRGBPixels(amiVideo_Screen *screen, const amiVideo_ULong *rgbPixels, unsigned int offset, unsigned int width)
+{
+    unsigned int j;
     
     if(amiVideo_checkHoldAndModify(screen->viewportMode))
     {
 	/* HAM mode has its own decompression technique */
 	
-	unsigned int i;
-	unsigned int offset = 0;
+	amiVideo_OutputColor previousResult = screen->palette.chunkyFormat.color[0];
 	
-	for(i = 0; i < screen->height; i++)
+	for(j = 0; j < width; j++)
 	{
-	    unsigned int j;
-	    amiVideo_OutputColor previousResult = screen->palette.chunkyFormat.color[0];
+	    amiVideo_UByte byte = screen->uncorrectedChunkyFormat.pixels[offset + j];
+	    amiVideo_UByte mode = (byte & (0x3 << (screen->bitplaneDepth - 2))) >> (screen->bitplaneDepth - 2);
+	    amiVideo_UByte index = byte & ~(0x3 << (screen->bitplaneDepth - 2));
+	    amiVideo_OutputColor result;
 	    
-	    for(j = 0; j < screenWidthInPixels; j++)
+	    if(mode == 0x0) /* Data bits are an index in the color palette */
+		result = screen->palette.chunkyFormat.color[index];
+	    else if(mode == 0x1) /* Data bits are blue level */
 	    {
-		amiVideo_UByte byte = screen->uncorrectedChunkyFormat.pixels[offset + j];
-		amiVideo_UByte mode = (byte & (0x3 << (screen->bitplaneDepth - 2))) >> (screen->bitplaneDepth - 2);
-		amiVideo_UByte index = byte & ~(0x3 << (screen->bitplaneDepth - 2));
-		amiVideo_OutputColor result;
-		
-		if(mode == 0x0) /* Data bits are an index in the color palette */
-		    result = screen->palette.chunkyFormat.color[index];
-		else if(mode == 0x1) /* Data bits are blue level */
-		{
-		    result = previousResult;
-		    result.b = index << (8 - screen->bitplaneDepth + 2);
-		}
-		else if(mode == 0x2) /* Data bits are red level */
-		{
-		    result = previousResult;
-		    result.r = index << (8 - screen->bitplaneDepth + 2);
-		}
-		else if(mode == 0x3) /* Data bits are green level */
-		{
-		    result = previousResult;
-		    result.g = index << (8 - screen->bitplaneDepth + 2);
-		}
-		
-		/* set new pixel on offset + j */
-		screen->uncorrectedRGBFormat.pixels[offset + j] = convertColorToRGBPixel(&result, screen->uncorrectedRGBFormat.rshift, screen->uncorrectedRGBFormat.gshift, screen->uncorrectedRGBFormat.bshift, screen->uncorrectedRGBFormat.ashift);
-		
-		previousResult = result;
+		result = previousResult;
+		result.b = index << (8 - screen->bitplaneDepth + 2);
+	    }
+	    else if(mode == 0x2) /* Data bits are red level */
+	    {
+		result = previousResult;
+		result.r = index << (8 - screen->bitplaneDepth + 2);
+	    }
+	    else /* Data bits are green level */
+	    {
+		result = previousResult;
+		result.g = index << (8 - screen->bitplaneDepth + 2);
 	    }
 	    
-	    offset += screenWidthInPixels;
+	    /* set new pixel on offset + j */
+	    screen->uncorrectedRGBFormat.pixels[offset + j] = convertColorToRGBPixel(&result, screen->uncorrectedRGBFormat.rshift, screen->uncorrectedRGBFormat.gshift, screen->uncorrectedRGBFormat.bshift, screen->uncorrectedRGBFormat.ashift);
+	    
+	    previousResult = result;
 	}
     }
     else
     {
 	/* Normal mode */
 	
-	unsigned int i;
-	
-	for(i = 0; i < screenWidthInPixels * screen->height; i++)
-	    screen->uncorrectedRGBFormat.pixels[i] = convertColorToRGBPixel(&screen->palette.chunkyFormat.color[screen->uncorrectedChunkyFormat.pixels[i]], screen->uncorrectedRGBFormat.rshift, screen->uncorrectedRGBFormat.gshift, screen->uncorrectedRGBFormat.bshift, screen->uncorrectedRGBFormat.ashift);
+	for(j = 0; j < width; j++)
+	    screen->uncorrectedRGBFormat.pixels[offset + j] = rgbPixels[screen->uncorrectedChunkyFormat.pixels[offset + j]];
     }
 }
 
-void amiVideo_convertScreenChunkyPixelsToBitplanes(amiVideo_Screen *screen)
+void amiVideo_convertScreenChunkyPixelsToRGBPixels(amiVideo_Screen *screen)
+{
+    unsigned int screenWidthInPixels = screen->uncorrectedRGBFormat.pitch / 4;
+    amiVideo_ULong rgbPixels[256];
+    unsigned int i;
+    
+    convertPaletteToRGBPixels(screen, rgbPixels);
+    
+    for(i = 0; i < screen->height; i++)
+        convertScanLineChunkyPixelsToRGBPixels(screen, rgbPixels, i * screenWidthInPixels, screenWidthInPixels);
+}
+
+/*
+ * Chunky to planar conversion. The pixels are a stream of width * height bytes
+ * converted into a stream of bits in each bitplane, 8 pixels making a byte.
+ */
+
+typedef void (*c2pFunction)(const amiVideo_UByte *pixels, amiVideo_UByte **bitplanes, unsigned long numOfBytes);
+
+/* Converts 8 pixels into the byte at offset of each bitplane, as a transposition of an 8x8 bit matrix */
+static void c2pByte(const amiVideo_UByte *pixels, amiVideo_UByte **bitplanes, unsigned long offset, unsigned int bitplaneDepth)
 {
+    amiVideo_ULong x = ((amiVideo_ULong)pixels[0] << 24) | ((amiVideo_ULong)pixels[1] << 16) | ((amiVideo_ULong)pixels[2] << 8) | pixels[3];
+    amiVideo_ULong y = ((amiVideo_ULong)pixels[4] << 24) | ((amiVideo_ULong)pixels[5] << 16) | ((amiVideo_ULong)pixels[6] << 8) | pixels[7];
+    amiVideo_ULong t;
     unsigned int i;
-    unsigned int bitplaneIndex = 0;
-    int bit = 7;
     
-    for (i = 0; i < screen->width * screen->height; i++)
+    t = (x ^ (x >> 7)) & 0x00AA00AA; x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA; y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+    
+    /* The bits i of the 8 pixels are now the byte 7 - i of x:y */
+    for(i = 0; i < bitplaneDepth; i++)
+        bitplanes[i][offset] = (amiVideo_UByte)(((i < 4 ? y : x) >> (8 * (i & 3))) & 0xFF);
+}
+
+/* Converts 8 * numOfBytes pixels, several bytes at a time when SIMD instructions are available */
+static void c2pBytes(const amiVideo_UByte *pixels, amiVideo_UByte **bitplanes, unsigned long numOfBytes, unsigned int bitplaneDepth)
+{
+    unsigned long i = 0;
+#if defined(__AVX2__)
+    /* The bytes are reversed, so that the first pixel of a byte ends up in its most significant bit */
+    const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    
+    for(; i + 4 <= numOfBytes; i += 4)
     {
+        __m256i chunky = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(pixels + 8 * i)), reverse);
         unsigned int j;
-        amiVideo_UByte bitmask = 1 << bit;
+        
+        for(j = 0; j < bitplaneDepth; j++)
+        {
+            /* The bit j of each pixel is shifted to the sign bit of its byte */
+            amiVideo_ULong mask = (amiVideo_ULong)_mm256_movemask_epi8(_mm256_sll_epi16(chunky, _mm_cvtsi32_si128(7 - j)));
+            amiVideo_UByte *bitplane = bitplanes[j] + i;
+            
+            bitplane[0] = (amiVideo_UByte)(mask >> 8);
+            bitplane[1] = (amiVideo_UByte)mask;
+            bitplane[2] = (amiVideo_UByte)(mask >> 24);
+            bitplane[3] = (amiVideo_UByte)(mask >> 16);
+        }
+    }
+#elif defined(AMIVIDEO_SSE2)
+    for(; i + 2 <= numOfBytes; i += 2)
+    {
+        __m128i chunky = _mm_loadu_si128((const __m128i*)(pixels + 8 * i));
+        unsigned int j;
+        
+        /* The bytes are reversed, so that the first pixel of a byte ends up in its most significant bit */
+        chunky = _mm_shuffle_epi32(chunky, 0x1B);
+        chunky = _mm_shufflehi_epi16(_mm_shufflelo_epi16(chunky, 0xB1), 0xB1);
+        chunky = _mm_or_si128(_mm_slli_epi16(chunky, 8), _mm_srli_epi16(chunky, 8));
+        
+        for(j = 0; j < bitplaneDepth; j++)
+        {
+            /* The bit j of each pixel is shifted to the sign bit of its byte */
+            amiVideo_ULong mask = (amiVideo_ULong)_mm_movemask_epi8(_mm_sll_epi16(chunky, _mm_cvtsi32_si128(7 - j)));
+            amiVideo_UByte *bitplane = bitplanes[j] + i;
+            
+            bitplane[0] = (amiVideo_UByte)(mask >> 8);
+            bitplane[1] = (amiVideo_UByte)mask;
+        }
+    }
+#endif
+    for(; i < numOfBytes; i++)
+        c2pByte(pixels + 8 * i, bitplanes, i, bitplaneDepth);
+}
 
-        for (j = 0; j < screen->bitplaneDepth; j++)
+/* Variants for each depth, the depth being a constant for the compiler */
+#define C2P_VARIANT(depth) \
+static void c2pDepth##depth(const amiVideo_UByte *pixels, amiVideo_UByte **bitplanes, unsigned long numOfBytes) \
+{ \
+    c2pBytes(pixels, bitplanes, numOfBytes, depth); \
+}
+
+C2P_VARIANT(1)
+C2P_VARIANT(2)
+C2P_VARIANT(3)
+C2P_VARIANT(4)
+C2P_VARIANT(5)
+C2P_VARIANT(6)
+C2P_VARIANT(7)
+C2P_VARIANT(8)
+
+static const c2pFunction c2pFunctions[] = { NULL, c2pDepth1, c2pDepth2, c2pDepth3, c2pDepth4, c2pDepth5, c2pDepth6, c2pDepth7, c2pDepth8 };
+
+/* Converts the pixels of the given range, starting at a byte boundary of the bitplanes */
+static void convertScreenChunkyPixelRangeToBitplanes(amiVideo_Screen *screen, unsigned long firstPixel, unsigned long numOfPixels)
+{
+    unsigned long numOfBytes = 0;
+    unsigned long i;
+    
+    if(screen->bitplaneDepth >= 1 && screen->bitplaneDepth <= 8)
+    {
+        amiVideo_UByte *bitplanes[8];
+        unsigned int j;
+        
+        for(j = 0; j < screen->bitplaneDepth; j++)
+            bitplanes[j] = screen->bitplaneFormat.bitplanes[j] + firstPixel / 8;
+        
+        numOfBytes = numOfPixels / 8;
+        c2pFunctions[screen->bitplaneDepth](screen->uncorrectedChunkyFormat.pixels + firstPixel, bitplanes, numOfBytes);
+    }
+    
+    /* The remaining pixels, which do not fill a whole byte, leave the other bits of the byte untouched */
+    for(i = firstPixel + numOfBytes * 8; i < firstPixel + numOfPixels; i++)
+    {
+        unsigned int j;
+        amiVideo_UByte bitmask = 1 << (7 - i % 8);
+        
+        for(j = 0; j < screen->bitplaneDepth; j++)
         {
-            if (screen->uncorrectedChunkyFormat.pixels[i] & (1 << j)) /* Check if the current bit of the index value is set */
-                screen->bitplaneFormat.bitplanes[j][bitplaneIndex] |= bitmask; /* Modify the current bit in the bitplane byte to be 1 and leave the others untouched */
+            if(screen->uncorrectedChunkyFormat.pixels[i] & (1 << j)) /* Check if the current bit of the index value is set */
+                screen->bitplaneFormat.bitplanes[j][i / 8] |= bitmask; /* Modify the current bit in the bitplane byte to be 1 and leave the others untouched */
             else
-                screen->bitplaneFormat.bitplanes[j][bitplaneIndex] &= ~bitmask; /* Modify the current bit in the bitplane byte to be 0 and leave the others untouched */
+                screen->bitplaneFormat.bitplanes[j][i / 8] &= ~bitmask; /* Modify the current bit in the bitplane byte to be 0 and leave the others untouched */
         }
+    }
+}
 
-        bit--;
+void amiVideo_convertScreenChunkyPixelsToBitplanes(amiVideo_Screen *screen)
+{
+    convertScreenChunkyPixelRangeToBitplanes(screen, 0, (unsigned long)screen->width * screen->height);
+}
 
-        if (bit < 0)
+void amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(amiVideo_Screen *screen, unsigned int firstScanLine, unsigned int numOfScanLines, amiVideo_UByte *bitplanes)
+{
+    unsigned int bitplaneDepth = screen->bitplaneDepth > 8 ? 8 : screen->bitplaneDepth;
+    unsigned int numOfBytes = screen->width / 8;
+    unsigned int i;
+    
+    for(i = 0; i < numOfScanLines; i++)
+    {
+        const amiVideo_UByte *pixels = screen->uncorrectedChunkyFormat.pixels + (firstScanLine + i) * screen->uncorrectedChunkyFormat.pitch;
+        amiVideo_UByte *rows[AMIVIDEO_MAX_NUM_OF_BITPLANES];
+        unsigned int j;
+        
+        /* The rows of every bitplane follow each other for each scan line, their padding bits being cleared */
+        for(j = 0; j < screen->bitplaneDepth; j++)
+        {
+            unsigned int start = j < bitplaneDepth ? numOfBytes : 0;
+            
+            rows[j] = bitplanes + (i * screen->bitplaneDepth + j) * screen->bitplaneFormat.pitch;
+            memset(rows[j] + start, '\0', screen->bitplaneFormat.pitch - start);
+        }
+        
+        if(bitplaneDepth > 0)
         {
-            bit = 7; /* Reset the bit counter */
-            bitplaneIndex++; /* Go to the next byte in the bitplane memory */
+            unsigned int k;
+            
+            c2pFunctions[bitplaneDepth](pixels, rows, numOfBytes);
+            
+            for(k = numOfBytes * 8; k < screen->width; k++)
+            {
+                for(j = 0; j < bitplaneDepth; j++)
+                {
+                    if(pixels[k] & (1 << j))
+                        rows[j][k / 8] |= 1 << (7 - k % 8);
+                }
+            }
+        }
+    }
+}
+
+void amiVideo_convertScreenChunkyPixelsToInterleavedBitplanes(amiVideo_Screen *screen, amiVideo_UByte *bitplanes)
+{
+    amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(screen, 0, screen->height, bitplanes);
+}
+
+/* State of a conversion split into bands of scan lines */
+typedef struct
+{
+    amiVideo_Screen *screen;
+    amiVideo_UByte *bitplanes;
+    unsigned int numOfBands;
+}
+BandConversion;
+
+/* Returns the first scan line of a band, the scan lines being evenly spread over the bands */
+static unsigned int calculateFirstScanLineOfBand(const BandConversion *conversion, unsigned int band)
+{
+    return (unsigned long)conversion->screen->height * band / conversion->numOfBands;
+}
+
+static void convertScreenBandBitplanesToChunkyPixels(void *data, unsigned int band)
+{
+    const BandConversion *conversion = (const BandConversion*)data;
+    unsigned int firstScanLine = calculateFirstScanLineOfBand(conversion, band);
+    
+    convertScreenBitplaneScanLinesToChunkyPixels(conversion->screen, firstScanLine, calculateFirstScanLineOfBand(conversion, band + 1) - firstScanLine);
+}
+
+static void convertScreenBandChunkyPixelsToBitplanes(void *data, unsigned int band)
+{
+    const BandConversion *conversion = (const BandConversion*)data;
+    amiVideo_Screen *screen = conversion->screen;
+    
+    /* The bitplanes are a stream of bytes ignoring the scan lines, so a band starts and ends at the byte holding the start of its scan lines */
+    unsigned long firstPixel = (unsigned long)screen->width * calculateFirstScanLineOfBand(conversion, band) / 8 * 8;
+    unsigned long lastPixel = (unsigned long)screen->width * screen->height;
+    
+    if(band + 1 < conversion->numOfBands)
+        lastPixel = (unsigned long)screen->width * calculateFirstScanLineOfBand(conversion, band + 1) / 8 * 8;
+    
+    convertScreenChunkyPixelRangeToBitplanes(screen, firstPixel, lastPixel - firstPixel);
+}
+
+static void convertScreenBandChunkyPixelsToInterleavedBitplanes(void *data, unsigned int band)
+{
+    const BandConversion *conversion = (const BandConversion*)data;
+    amiVideo_Screen *screen = conversion->screen;
+    unsigned int firstScanLine = calculateFirstScanLineOfBand(conversion, band);
+    
+    amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(screen, firstScanLine, calculateFirstScanLineOfBand(conversion, band + 1) - firstScanLine, conversion->bitplanes + (unsigned long)firstScanLine * screen->bitplaneDepth * screen->bitplaneFormat.pitch);
+}
+
+/* Splits the scan lines of the screen into the bands of the executor and runs the task converting them */
+static void convertScreenInBands(amiVideo_Screen *screen, amiVideo_UByte *bitplanes, amiVideo_BandTask task, const amiVideo_Executor *executor)
+{
+    BandConversion conversion;
+    
+    conversion.screen = screen;
+    conversion.bitplanes = bitplanes;
+    conversion.numOfBands = executor == NULL ? 1 : executor->numOfBands;
+    
+    /* A band has at least one scan line */
+    if(conversion.numOfBands > (unsigned int)screen->height)
+        conversion.numOfBands = screen->height;
+    
+    if(conversion.numOfBands <= 1)
+    {
+        conversion.numOfBands = 1;
+        task(&conversion, 0);
+    }
+    else
+        executor->run(executor->data, task, &conversion, conversion.numOfBands);
+}
+
+void amiVideo_convertScreenBitplanesToChunkyPixelsInBands(amiVideo_Screen *screen, const amiVideo_Executor *executor)
+{
+    convertScreenInBands(screen, NULL, convertScreenBandBitplanesToChunkyPixels, executor);
+}
+
+void amiVideo_convertScreenChunkyPixelsToBitplanesInBands(amiVideo_Screen *screen, const amiVideo_Executor *executor)
+{
+    convertScreenInBands(screen, NULL, convertScreenBandChunkyPixelsToBitplanes, executor);
+}
+
+void amiVideo_convertScreenChunkyPixelsToInterleavedBitplanesInBands(amiVideo_Screen *screen, amiVideo_UByte *bitplanes, const amiVideo_Executor *executor)
+{
+    convertScreenInBands(screen, bitplanes, convertScreenBandChunkyPixelsToInterleavedBitplanes, executor);
+}
+
+/* Scales a scan line horizontally by repeating each of its pixels */
+typedef void (*replicateFunction)(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width);
+
+static void replicateBytes2(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width)
+{
+    unsigned int i = 0;
+    
+#if defined(__AVX2__)
+    /* The unpacks work within each 128-bit lane, so the middle quadwords are swapped first */
+    for(; i + 32 <= width; i += 32)
+    {
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(pixels + i)), 0xD8);
+        
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 2 * i), _mm256_unpacklo_epi8(v, v));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 2 * i + 32), _mm256_unpackhi_epi8(v, v));
+    }
+#elif defined(AMIVIDEO_SSE2)
+    for(; i + 16 <= width; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+        
+        _mm_storeu_si128((__m128i*)(correctedPixels + 2 * i), _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 2 * i + 16), _mm_unpackhi_epi8(v, v));
+    }
+#endif
+    
+    for(; i < width; i++)
+        correctedPixels[2 * i] = correctedPixels[2 * i + 1] = pixels[i];
+}
+
+static void replicateBytes4(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width)
+{
+    unsigned int i = 0;
+    
+#if defined(__AVX2__)
+    for(; i + 32 <= width; i += 32)
+    {
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(pixels + i)), 0xD8);
+        __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi8(v, v), 0xD8);
+        __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi8(v, v), 0xD8);
+        
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 4 * i), _mm256_unpacklo_epi16(lo, lo));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 4 * i + 32), _mm256_unpackhi_epi16(lo, lo));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 4 * i + 64), _mm256_unpacklo_epi16(hi, hi));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 4 * i + 96), _mm256_unpackhi_epi16(hi, hi));
+    }
+#elif defined(AMIVIDEO_SSE2)
+    for(; i + 16 <= width; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i lo = _mm_unpacklo_epi8(v, v);
+        __m128i hi = _mm_unpackhi_epi8(v, v);
+        
+        _mm_storeu_si128((__m128i*)(correctedPixels + 4 * i), _mm_unpacklo_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 4 * i + 16), _mm_unpackhi_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 4 * i + 32), _mm_unpacklo_epi16(hi, hi));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 4 * i + 48), _mm_unpackhi_epi16(hi, hi));
+    }
+#endif
+    
+    for(; i < width; i++)
+        memset(correctedPixels + 4 * i, pixels[i], 4);
+}
+
+static void replicateLongs2(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width)
+{
+    unsigned int i = 0;
+    
+#if defined(__AVX2__)
+    for(; i + 8 <= width; i += 8)
+    {
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(pixels + 4 * i)), 0xD8);
+        
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 8 * i), _mm256_unpacklo_epi32(v, v));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 8 * i + 32), _mm256_unpackhi_epi32(v, v));
+    }
+#elif defined(AMIVIDEO_SSE2)
+    for(; i + 4 <= width; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + 4 * i));
+        
+        _mm_storeu_si128((__m128i*)(correctedPixels + 8 * i), _mm_unpacklo_epi32(v, v));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 8 * i + 16), _mm_unpackhi_epi32(v, v));
+    }
+#endif
+    
+    for(; i < width; i++)
+    {
+        memcpy(correctedPixels + 8 * i, pixels + 4 * i, 4);
+        memcpy(correctedPixels + 8 * i + 4, pixels + 4 * i, 4);
+    }
+}
+
+static void replicateLongs4(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width)
+{
+    unsigned int i = 0;
+    
+#if defined(__AVX2__)
+    for(; i + 8 <= width; i += 8)
+    {
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(pixels + 4 * i)), 0xD8);
+        __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi32(v, v), 0xD8);
+        __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi32(v, v), 0xD8);
+        
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 16 * i), _mm256_unpacklo_epi64(lo, lo));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 16 * i + 32), _mm256_unpackhi_epi64(lo, lo));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 16 * i + 64), _mm256_unpacklo_epi64(hi, hi));
+        _mm256_storeu_si256((__m256i*)(correctedPixels + 16 * i + 96), _mm256_unpackhi_epi64(hi, hi));
+    }
+#elif defined(AMIVIDEO_SSE2)
+    for(; i + 4 <= width; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pixels + 4 * i));
+        __m128i lo = _mm_unpacklo_epi32(v, v);
+        __m128i hi = _mm_unpackhi_epi32(v, v);
+        
+        _mm_storeu_si128((__m128i*)(correctedPixels + 16 * i), _mm_unpacklo_epi64(lo, lo));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 16 * i + 16), _mm_unpackhi_epi64(lo, lo));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 16 * i + 32), _mm_unpacklo_epi64(hi, hi));
+        _mm_storeu_si128((__m128i*)(correctedPixels + 16 * i + 48), _mm_unpackhi_epi64(hi, hi));
+    }
+#endif
+    
+    for(; i < width; i++)
+    {
+        unsigned int j;
+        
+        for(j = 0; j < 4; j++)
+            memcpy(correctedPixels + 16 * i + 4 * j, pixels + 4 * i, 4);
+    }
+}
+
+/* Returns the kernel repeating each pixel of a scan line, or NULL when there is none for this pixel size and number of repeats */
+static replicateFunction selectReplicateFunction(unsigned int bytesPerPixel, unsigned int repeatHorizontal)
+{
+    if(bytesPerPixel == 1 && repeatHorizontal == 2)
+        return replicateBytes2;
+    else if(bytesPerPixel == 1 && repeatHorizontal == 4)
+        return replicateBytes4;
+    else if(bytesPerPixel == 4 && repeatHorizontal == 2)
+        return replicateLongs2;
+    else if(bytesPerPixel == 4 && repeatHorizontal == 4)
+        return replicateLongs4;
+    else
+        return NULL;
+}
+
+/* Repeats each pixel of a scan line any number of times */
+static void replicatePixels(const amiVideo_UByte *pixels, amiVideo_UByte *correctedPixels, unsigned int width, unsigned int bytesPerPixel, unsigned int repeatHorizontal)
+{
+    unsigned int i;
+    
+    if(repeatHorizontal == 1)
+        memcpy(correctedPixels, pixels, width * bytesPerPixel);
+    else
+    {
+        for(i = 0; i < width; i++)
+        {
+            unsigned int j;
+            
+            for(j = 0; j < repeatHorizontal; j++)
+            {
+                memcpy(correctedPixels, pixels, bytesPerPixel);
+                correctedPixels += bytesPerPixel;
+            }
+            
+            pixels += bytesPerPixel;
         }
     }
 }
@@ -333,6 +929,7 @@ void amiVideo_correctScreenPixels(amiVideo_Screen *screen)
     unsigned int repeatVertical;
     
     amiVideo_UByte *pixels;
+    replicateFunction replicate;
     
     /* Calculate how many times we have to horizontally repeat a pixel */
     if(amiVideo_checkSuperHires(screen->viewportMode))
@@ -356,24 +953,22 @@ void amiVideo_correctScreenPixels(amiVideo_Screen *screen)
     else
 	pixels = (amiVideo_UByte*)screen->uncorrectedRGBFormat.pixels;
     
+    /* The usual doubling and quadrupling of the pixels have specialised kernels */
+    replicate = selectReplicateFunction(screen->correctedFormat.bytesPerPixel, repeatHorizontal);
+    
     /* Do the correction */
     for(i = 0; i < screen->height; i++)
     {
 	unsigned int j;
 	
-	for(j = 0; j < screen->width; j++)
-	{
-	    unsigned int k;
-	    
-	    /* Scale the pixel horizontally */
-	    for(k = 0; k < repeatHorizontal; k++)
-	    {
-	        memcpy((amiVideo_UByte*)screen->correctedFormat.pixels + destOffset, pixels + sourceOffset, screen->correctedFormat.bytesPerPixel);
-	        destOffset += screen->correctedFormat.bytesPerPixel;
-	    }
+	/* Scale the scanline horizontally */
+	if(replicate == NULL)
+	    replicatePixels(pixels + sourceOffset, (amiVideo_UByte*)screen->correctedFormat.pixels + destOffset, screen->width, screen->correctedFormat.bytesPerPixel, repeatHorizontal);
+	else
+	    replicate(pixels + sourceOffset, (amiVideo_UByte*)screen->correctedFormat.pixels + destOffset, screen->width);
 	
-	    sourceOffset += screen->correctedFormat.bytesPerPixel;
-	}
+	sourceOffset += screen->width * screen->correctedFormat.bytesPerPixel;
+	destOffset += screen->width * repeatHorizontal * screen->correctedFormat.bytesPerPixel;
 	
 	destOffset += screen->correctedFormat.pitch - screen->correctedFormat.width * screen->correctedFormat.bytesPerPixel; /* Skip the padding bytes */
 	
@@ -391,15 +986,38 @@ void amiVideo_convertScreenBitplanesToRGBPixels(amiVideo_Screen *screen)
 {
     if(screen->bitplaneDepth == 24 || screen->bitplaneDepth == 32) /* For true color images we directly convert bitplanes to RGB pixels */
     {
-        convertScreenBitplanesToTarget(screen, FALSE);
+        convertScreenTrueColorBitplanesToRGBPixels(screen);
         amiVideo_reorderRGBPixels(screen);
     }
     else
     {
         /* For lower bitplane depths we first have to compose chunky pixels to determine the actual color values */
         amiVideo_convertBitplaneColorsToChunkyFormat(&screen->palette);
-        amiVideo_convertScreenBitplanesToChunkyPixels(screen);
-        amiVideo_convertScreenChunkyPixelsToRGBPixels(screen);
+        
+        if(screen->uncorrectedChunkyFormat.pitch == screen->uncorrectedRGBFormat.pitch / 4)
+        {
+            /* Each scan line is converted to RGB pixels right after its chunky pixels, while they are still in the cache */
+            p2cFunction p2c = selectP2CFunction(screen);
+            amiVideo_ULong rgbPixels[256];
+            unsigned int i;
+            
+            convertPaletteToRGBPixels(screen, rgbPixels);
+            
+            for(i = 0; i < screen->height; i++)
+            {
+                unsigned int offset = i * screen->uncorrectedChunkyFormat.pitch;
+                
+                if(p2c != NULL)
+                    p2c(screen->bitplaneFormat.bitplanes, i * screen->bitplaneFormat.pitch, screen->uncorrectedChunkyFormat.pixels + offset, screen->width);
+                
+                convertScanLineChunkyPixelsToRGBPixels(screen, rgbPixels, offset, screen->uncorrectedChunkyFormat.pitch);
+            }
+        }
+        else
+        {
+            amiVideo_convertScreenBitplanesToChunkyPixels(screen);
+            amiVideo_convertScreenChunkyPixelsToRGBPixels(screen);
+        }
     }
 }
 
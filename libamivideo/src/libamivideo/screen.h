@@ -155,6 +155,35 @@ typedef enum
 }
 amiVideo_ColorFormat;
 
+/**
+ * Converts the scan lines of the given band of a screen.
+ *
+ * @param data Conversion state, shared by all the bands
+ * @param band Index of the band to convert
+ */
+typedef void (*amiVideo_BandTask)(void *data, unsigned int band);
+
+/**
+ * Runs the tasks converting the bands of scan lines of a screen, typically on
+ * a thread pool. The library itself depends on no threading library.
+ */
+typedef struct
+{
+    /**
+     * Invokes task(taskData, band) once for every band from 0 to numOfBands - 1,
+     * in any order and possibly concurrently, and returns when all of them have
+     * completed.
+     */
+    void (*run)(void *data, amiVideo_BandTask task, void *taskData, unsigned int numOfBands);
+    
+    /** Data passed to run(), such as a thread pool */
+    void *data;
+    
+    /** Number of bands the scan lines are split into, usually the number of threads */
+    unsigned int numOfBands;
+}
+amiVideo_Executor;
+
 /**
  * Initializes a screen instance with the given dimensions, bitplane depth,
  * specific size of color components and viewport mode.
@@ -307,6 +336,59 @@ void amiVideo_convertScreenChunkyPixelsToRGBPixels(amiVideo_Screen *screen);
  */
 void amiVideo_convertScreenChunkyPixelsToBitplanes(amiVideo_Screen *screen);
 
+/**
+ * Converts chunky pixels to the interleaved bitplane format of an ILBM body, in
+ * which the rows of all the bitplanes follow each other for each scan line.
+ * The padding bits of the rows are cleared.
+ *
+ * @param screen Screen conversion structure
+ * @param bitplanes Memory of bitplaneDepth * height rows of the bitplane pitch
+ */
+void amiVideo_convertScreenChunkyPixelsToInterleavedBitplanes(amiVideo_Screen *screen, amiVideo_UByte *bitplanes);
+
+/**
+ * Converts a range of scan lines of chunky pixels to the interleaved bitplane
+ * format of an ILBM body, so that a body can be produced a few scan lines at a
+ * time.
+ *
+ * @param screen Screen conversion structure
+ * @param firstScanLine Index of the first scan line to convert
+ * @param numOfScanLines Number of scan lines to convert
+ * @param bitplanes Memory of bitplaneDepth * numOfScanLines rows of the bitplane pitch
+ */
+void amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(amiVideo_Screen *screen, unsigned int firstScanLine, unsigned int numOfScanLines, amiVideo_UByte *bitplanes);
+
+/**
+ * Converts bitplanes to chunky pixels like
+ * amiVideo_convertScreenBitplanesToChunkyPixels(), splitting the scan lines
+ * into bands that are converted by the given executor.
+ *
+ * @param screen Screen conversion structure
+ * @param executor Executor running the bands, or NULL to convert them in the calling thread
+ */
+void amiVideo_convertScreenBitplanesToChunkyPixelsInBands(amiVideo_Screen *screen, const amiVideo_Executor *executor);
+
+/**
+ * Converts chunky pixels to bitplanes like
+ * amiVideo_convertScreenChunkyPixelsToBitplanes(), splitting the scan lines
+ * into bands that are converted by the given executor.
+ *
+ * @param screen Screen conversion structure
+ * @param executor Executor running the bands, or NULL to convert them in the calling thread
+ */
+void amiVideo_convertScreenChunkyPixelsToBitplanesInBands(amiVideo_Screen *screen, const amiVideo_Executor *executor);
+
+/**
+ * Converts chunky pixels to interleaved bitplanes like
+ * amiVideo_convertScreenChunkyPixelsToInterleavedBitplanes(), splitting the
+ * scan lines into bands that are converted by the given executor.
+ *
+ * @param screen Screen conversion structure
+ * @param bitplanes Memory of bitplaneDepth * height rows of the bitplane pitch
+ * @param executor Executor running the bands, or NULL to convert them in the calling thread
+ */
+void amiVideo_convertScreenChunkyPixelsToInterleavedBitplanesInBands(amiVideo_Screen *screen, amiVideo_UByte *bitplanes, const amiVideo_Executor *executor);
+
 /**
  * Corrects the chunky or RGB pixel surface into a surface having the correct
  * aspect ratio taking the resolution settings into account.
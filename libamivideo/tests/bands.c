@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <screen.h>
+
+#define NUM_OF_SIZES 7
+#define NUM_OF_BAND_COUNTS 5
+
+static const amiVideo_Word sizes[NUM_OF_SIZES][2] = {
+    { 1, 1 }, { 3, 5 }, { 17, 3 }, { 13, 11 }, { 20, 9 }, { 320, 256 }, { 641, 7 }
+};
+
+static const unsigned int bandCounts[NUM_OF_BAND_COUNTS] = { 0, 1, 2, 3, 1000 };
+
+/* Executor running the bands one after the other in reverse order, recording which band has modified each byte of the output */
+typedef struct
+{
+    amiVideo_UByte *output;
+    amiVideo_UByte *previous;
+    int *bands;
+    unsigned int size;
+    unsigned int maxNumOfBands;
+    int status;
+}
+Recorder;
+
+static void runBandsBackwards(void *data, amiVideo_BandTask task, void *taskData, unsigned int numOfBands)
+{
+    Recorder *recorder = (Recorder*)data;
+    unsigned int band = numOfBands;
+
+    if(numOfBands > recorder->maxNumOfBands)
+    {
+        fprintf(stderr, "%u bands are run instead of at most %u!\n", numOfBands, recorder->maxNumOfBands);
+        recorder->status = 1;
+    }
+
+    while(band-- > 0)
+    {
+        unsigned int i;
+
+        memcpy(recorder->previous, recorder->output, recorder->size);
+        task(taskData, band);
+
+        for(i = 0; i < recorder->size; i++)
+        {
+            if(recorder->output[i] != recorder->previous[i])
+            {
+                /* Bands run concurrently, so they must never write to the same byte */
+                if(recorder->bands[i] >= 0)
+                {
+                    fprintf(stderr, "Byte %u is modified by the bands %d and %u!\n", i, recorder->bands[i], band);
+                    recorder->status = 1;
+                }
+
+                recorder->bands[i] = band;
+            }
+        }
+    }
+}
+
+static void initRecorder(Recorder *recorder, amiVideo_Executor *executor, amiVideo_UByte *output, unsigned int size, unsigned int numOfBands, unsigned int height)
+{
+    unsigned int i;
+
+    recorder->output = output;
+    recorder->previous = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    recorder->bands = (int*)malloc(size * sizeof(int));
+    recorder->size = size;
+    recorder->maxNumOfBands = numOfBands < height ? numOfBands : height;
+    recorder->status = 0;
+
+    for(i = 0; i < size; i++)
+        recorder->bands[i] = -1;
+
+    executor->run = runBandsBackwards;
+    executor->data = recorder;
+    executor->numOfBands = numOfBands;
+}
+
+static int checkRecorder(Recorder *recorder, const amiVideo_UByte *expected, const char *conversion, amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth, unsigned int numOfBands)
+{
+    int status = recorder->status;
+
+    if(memcmp(expected, recorder->output, recorder->size) != 0)
+    {
+        fprintf(stderr, "The %s of a %dx%d screen of depth %u in %u bands are not identical!\n", conversion, width, height, bitplaneDepth, numOfBands);
+        status = 1;
+    }
+
+    free(recorder->bands);
+    free(recorder->previous);
+    return status;
+}
+
+static int checkConversions(amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth, unsigned int numOfBands)
+{
+    amiVideo_Screen screen;
+    amiVideo_Executor executor;
+    Recorder recorder;
+    unsigned int numOfPixels = width * height;
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(numOfPixels * sizeof(amiVideo_UByte));
+    amiVideo_UByte *expectedPixels = (amiVideo_UByte*)malloc(numOfPixels * sizeof(amiVideo_UByte));
+    amiVideo_UByte *expected, *bitplanes;
+    unsigned int size, i;
+    int status = 0;
+
+    amiVideo_initScreen(&screen, width, height, bitplaneDepth, 8, 0);
+    size = screen.bitplaneFormat.pitch * height * bitplaneDepth;
+    expected = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    bitplanes = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+
+    for(i = 0; i < numOfPixels; i++)
+        pixels[i] = (amiVideo_UByte)(rand() & ((1 << bitplaneDepth) - 1));
+
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, pixels, width);
+
+    /* Chunky pixels to bitplanes, with garbage in the bits past the last pixel */
+    for(i = 0; i < size; i++)
+        expected[i] = bitplanes[i] = (amiVideo_UByte)rand();
+
+    amiVideo_setScreenBitplanes(&screen, expected);
+    amiVideo_convertScreenChunkyPixelsToBitplanes(&screen);
+
+    amiVideo_setScreenBitplanes(&screen, bitplanes);
+    initRecorder(&recorder, &executor, bitplanes, size, numOfBands, height);
+    amiVideo_convertScreenChunkyPixelsToBitplanesInBands(&screen, &executor);
+    status |= checkRecorder(&recorder, expected, "bitplanes", width, height, bitplaneDepth, numOfBands);
+
+    /* Chunky pixels to interleaved bitplanes */
+    for(i = 0; i < size; i++)
+        bitplanes[i] = (amiVideo_UByte)rand();
+
+    amiVideo_convertScreenChunkyPixelsToInterleavedBitplanes(&screen, expected);
+
+    initRecorder(&recorder, &executor, bitplanes, size, numOfBands, height);
+    amiVideo_convertScreenChunkyPixelsToInterleavedBitplanesInBands(&screen, bitplanes, &executor);
+    status |= checkRecorder(&recorder, expected, "interleaved bitplanes", width, height, bitplaneDepth, numOfBands);
+
+    /* Bitplanes back to chunky pixels */
+    for(i = 0; i < size; i++)
+        bitplanes[i] = (amiVideo_UByte)rand();
+
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, expectedPixels, width);
+    amiVideo_convertScreenBitplanesToChunkyPixels(&screen);
+
+    for(i = 0; i < numOfPixels; i++)
+        pixels[i] = (amiVideo_UByte)rand();
+
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, pixels, width);
+    initRecorder(&recorder, &executor, pixels, numOfPixels, numOfBands, height);
+    amiVideo_convertScreenBitplanesToChunkyPixelsInBands(&screen, &executor);
+    status |= checkRecorder(&recorder, expectedPixels, "chunky pixels", width, height, bitplaneDepth, numOfBands);
+
+    /* Without an executor, the calling thread converts the whole screen */
+    for(i = 0; i < numOfPixels; i++)
+        pixels[i] = (amiVideo_UByte)rand();
+
+    amiVideo_convertScreenBitplanesToChunkyPixelsInBands(&screen, NULL);
+
+    if(memcmp(expectedPixels, pixels, numOfPixels) != 0)
+    {
+        fprintf(stderr, "The chunky pixels of a %dx%d screen of depth %u without an executor are not identical!\n", width, height, bitplaneDepth);
+        status = 1;
+    }
+
+    free(bitplanes);
+    free(expected);
+    free(expectedPixels);
+    free(pixels);
+    amiVideo_cleanupScreen(&screen);
+
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+    int status = 0;
+
+    for(i = 0; i < NUM_OF_SIZES; i++)
+    {
+        unsigned int bitplaneDepth;
+
+        for(bitplaneDepth = 1; bitplaneDepth <= 8; bitplaneDepth++)
+        {
+            unsigned int j;
+
+            for(j = 0; j < NUM_OF_BAND_COUNTS; j++)
+                status |= checkConversions(sizes[i][0], sizes[i][1], bitplaneDepth, bandCounts[j]);
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <screen.h>
+
+#define NUM_OF_SIZES 10
+#define PADDING 5
+
+static const amiVideo_Word sizes[NUM_OF_SIZES][2] = {
+    { 1, 1 }, { 3, 5 }, { 8, 1 }, { 16, 2 }, { 17, 3 }, { 32, 20 }, { 33, 7 }, { 13, 11 }, { 320, 256 }, { 641, 3 }
+};
+
+/* The bit by bit conversion the optimised one must be identical to */
+static void convertChunkyPixelsToBitplanes(amiVideo_Screen *screen)
+{
+    unsigned int i;
+    unsigned int bitplaneIndex = 0;
+    int bit = 7;
+    
+    for (i = 0; i < screen->width * screen->height; i++)
+    {
+        unsigned int j;
+        amiVideo_UByte bitmask = 1 << bit;
+
+        for (j = 0; j < screen->bitplaneDepth; j++)
+        {
+            if (screen->uncorrectedChunkyFormat.pixels[i] & (1 << j))
+                screen->bitplaneFormat.bitplanes[j][bitplaneIndex] |= bitmask;
+            else
+                screen->bitplaneFormat.bitplanes[j][bitplaneIndex] &= ~bitmask;
+        }
+
+        bit--;
+
+        if (bit < 0)
+        {
+            bit = 7;
+            bitplaneIndex++;
+        }
+    }
+}
+
+static int checkConversion(amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth)
+{
+    amiVideo_Screen screen;
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(width * height * sizeof(amiVideo_UByte));
+    amiVideo_UByte *expected, *bitplanes;
+    unsigned int size, i;
+    int status;
+    
+    amiVideo_initScreen(&screen, width, height, bitplaneDepth, 8, 0);
+    size = screen.bitplaneFormat.pitch * height * bitplaneDepth;
+    expected = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    bitplanes = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    
+    for(i = 0; i < (unsigned int)(width * height); i++)
+        pixels[i] = (amiVideo_UByte)(rand() & ((1 << bitplaneDepth) - 1));
+    
+    /* Garbage in the bitplanes, as the bits past the last pixel must be left untouched */
+    for(i = 0; i < size; i++)
+        expected[i] = bitplanes[i] = (amiVideo_UByte)rand();
+    
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, pixels, width);
+    
+    amiVideo_setScreenBitplanes(&screen, expected);
+    convertChunkyPixelsToBitplanes(&screen);
+    
+    amiVideo_setScreenBitplanes(&screen, bitplanes);
+    amiVideo_convertScreenChunkyPixelsToBitplanes(&screen);
+    
+    if(memcmp(expected, bitplanes, size) == 0)
+        status = 0;
+    else
+    {
+        fprintf(stderr, "The bitplanes of a %dx%d screen of depth %u are not identical!\n", width, height, bitplaneDepth);
+        status = 1;
+    }
+    
+    free(bitplanes);
+    free(expected);
+    free(pixels);
+    amiVideo_cleanupScreen(&screen);
+    
+    return status;
+}
+
+static int checkInterleavedConversion(amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth)
+{
+    amiVideo_Screen screen;
+    unsigned int pitch = width + PADDING;
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(pitch * height * sizeof(amiVideo_UByte));
+    amiVideo_UByte *expected, *bitplanes;
+    unsigned int size, i;
+    int status;
+    
+    amiVideo_initScreen(&screen, width, height, bitplaneDepth, 8, 0);
+    size = screen.bitplaneFormat.pitch * height * bitplaneDepth;
+    expected = (amiVideo_UByte*)calloc(size, sizeof(amiVideo_UByte));
+    bitplanes = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    
+    /* The padding bytes of the pixels must be ignored */
+    for(i = 0; i < pitch * height; i++)
+        pixels[i] = (amiVideo_UByte)(rand() & (i % pitch < (unsigned int)width ? (1 << bitplaneDepth) - 1 : 0xFF));
+    
+    /* Garbage in the bitplanes, as every bit of the rows must be written */
+    for(i = 0; i < size; i++)
+        bitplanes[i] = (amiVideo_UByte)rand();
+    
+    for(i = 0; i < (unsigned int)(width * height); i++)
+    {
+        unsigned int x = i % width;
+        unsigned int y = i / width;
+        unsigned int j;
+        
+        for(j = 0; j < bitplaneDepth; j++)
+        {
+            if(pixels[y * pitch + x] & (1 << j))
+                expected[(y * bitplaneDepth + j) * screen.bitplaneFormat.pitch + x / 8] |= 1 << (7 - x % 8);
+        }
+    }
+    
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, pixels, pitch);
+    amiVideo_convertScreenChunkyPixelsToInterleavedBitplanes(&screen, bitplanes);
+    
+    if(memcmp(expected, bitplanes, size) == 0)
+        status = 0;
+    else
+    {
+        fprintf(stderr, "The interleaved bitplanes of a %dx%d screen of depth %u are not identical!\n", width, height, bitplaneDepth);
+        status = 1;
+    }
+    
+    /* The same, one scan line at a time */
+    for(i = 0; i < (unsigned int)height; i++)
+    {
+        unsigned int scanLineSize = screen.bitplaneFormat.pitch * bitplaneDepth;
+        
+        amiVideo_convertScreenChunkyScanLinesToInterleavedBitplanes(&screen, i, 1, bitplanes);
+        
+        if(memcmp(expected + i * scanLineSize, bitplanes, scanLineSize) != 0)
+        {
+            fprintf(stderr, "The interleaved scan line %u of a %dx%d screen of depth %u is not identical!\n", i, width, height, bitplaneDepth);
+            status = 1;
+        }
+    }
+    
+    free(bitplanes);
+    free(expected);
+    free(pixels);
+    amiVideo_cleanupScreen(&screen);
+    
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int bitplaneDepth, i;
+    int status = 0;
+    
+    srand(0);
+    
+    for(bitplaneDepth = 1; bitplaneDepth <= 8; bitplaneDepth++)
+    {
+        for(i = 0; i < NUM_OF_SIZES; i++)
+        {
+            status |= checkConversion(sizes[i][0], sizes[i][1], bitplaneDepth);
+            status |= checkInterleavedConversion(sizes[i][0], sizes[i][1], bitplaneDepth);
+        }
+    }
+    
+    return status;
+}
@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <screen.h>
+#include <viewportmode.h>
+
+/*
+ * Checks the aspect correction against the pixel by pixel one. Invoked as
+ * "correct benchmark", it also reports the throughput of both of them.
+ */
+
+#define NUM_OF_SIZES 6
+#define NUM_OF_VIEWPORT_MODES 5
+#define NUM_OF_SCALE_FACTORS 4
+#define PADDING 12
+
+static const amiVideo_Word sizes[NUM_OF_SIZES][2] = {
+    { 1, 1 }, { 3, 5 }, { 17, 3 }, { 33, 7 }, { 320, 256 }, { 641, 3 }
+};
+
+static const amiVideo_Long viewportModes[NUM_OF_VIEWPORT_MODES] = {
+    0, AMIVIDEO_VIDEOPORTMODE_HIRES, AMIVIDEO_VIDEOPORTMODE_SUPERHIRES, AMIVIDEO_VIDEOPORTMODE_LACE, AMIVIDEO_VIDEOPORTMODE_HIRES | AMIVIDEO_VIDEOPORTMODE_LACE
+};
+
+static const unsigned int scaleFactors[NUM_OF_SCALE_FACTORS] = { 1, 2, 4, 8 };
+
+/* The pixel by pixel correction the optimised one must be identical to */
+static void correctScreenPixels(amiVideo_Screen *screen)
+{
+    unsigned int i;
+    unsigned int sourceOffset = 0, destOffset = 0;
+    unsigned int repeatHorizontal, repeatVertical;
+    amiVideo_UByte *pixels;
+
+    if(amiVideo_checkSuperHires(screen->viewportMode))
+        repeatHorizontal = screen->correctedFormat.lowresPixelScaleFactor / 4;
+    else if(amiVideo_checkHires(screen->viewportMode))
+        repeatHorizontal = screen->correctedFormat.lowresPixelScaleFactor / 2;
+    else
+        repeatHorizontal = screen->correctedFormat.lowresPixelScaleFactor;
+
+    if(amiVideo_checkLaced(screen->viewportMode))
+        repeatVertical = screen->correctedFormat.lowresPixelScaleFactor / 2;
+    else
+        repeatVertical = screen->correctedFormat.lowresPixelScaleFactor;
+
+    if(screen->correctedFormat.bytesPerPixel == 1)
+        pixels = screen->uncorrectedChunkyFormat.pixels;
+    else
+        pixels = (amiVideo_UByte*)screen->uncorrectedRGBFormat.pixels;
+
+    for(i = 0; i < screen->height; i++)
+    {
+        unsigned int j;
+
+        for(j = 0; j < screen->width; j++)
+        {
+            unsigned int k;
+
+            for(k = 0; k < repeatHorizontal; k++)
+            {
+                memcpy((amiVideo_UByte*)screen->correctedFormat.pixels + destOffset, pixels + sourceOffset, screen->correctedFormat.bytesPerPixel);
+                destOffset += screen->correctedFormat.bytesPerPixel;
+            }
+
+            sourceOffset += screen->correctedFormat.bytesPerPixel;
+        }
+
+        destOffset += screen->correctedFormat.pitch - screen->correctedFormat.width * screen->correctedFormat.bytesPerPixel;
+
+        for(j = 1; j < repeatVertical; j++)
+        {
+            memcpy((amiVideo_UByte*)screen->correctedFormat.pixels + destOffset, (amiVideo_UByte*)screen->correctedFormat.pixels + destOffset - screen->correctedFormat.pitch, screen->correctedFormat.pitch);
+            destOffset += screen->correctedFormat.pitch;
+        }
+    }
+}
+
+/* Sets up a screen of random pixels, with the corrected pixels in the given memory of the returned size */
+static unsigned int initScreen(amiVideo_Screen *screen, amiVideo_Word width, amiVideo_Word height, unsigned int bytesPerPixel, amiVideo_Long viewportMode, unsigned int lowresPixelScaleFactor, amiVideo_UByte *pixels, amiVideo_UByte **correctedPixels)
+{
+    unsigned int pitch, size, i;
+
+    amiVideo_initScreen(screen, width, height, 4, 8, viewportMode);
+    amiVideo_setLowresPixelScaleFactor(screen, lowresPixelScaleFactor);
+
+    pitch = screen->correctedFormat.width * bytesPerPixel + PADDING;
+    size = pitch * screen->correctedFormat.height;
+    *correctedPixels = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+
+    for(i = 0; i < (unsigned int)(width * height * bytesPerPixel); i++)
+        pixels[i] = (amiVideo_UByte)rand();
+
+    amiVideo_setScreenCorrectedPixelsPointer(screen, *correctedPixels, pitch, bytesPerPixel, 0, 0, 8, 16, 24);
+
+    if(bytesPerPixel == 1)
+        amiVideo_setScreenUncorrectedChunkyPixelsPointer(screen, pixels, width);
+    else
+        amiVideo_setScreenUncorrectedRGBPixelsPointer(screen, (amiVideo_ULong*)pixels, width * 4, 0, 0, 8, 16, 24);
+
+    return size;
+}
+
+static int checkCorrection(amiVideo_Word width, amiVideo_Word height, unsigned int bytesPerPixel, amiVideo_Long viewportMode, unsigned int lowresPixelScaleFactor)
+{
+    amiVideo_Screen screen;
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(width * height * bytesPerPixel * sizeof(amiVideo_UByte));
+    amiVideo_UByte *correctedPixels, *expected;
+    unsigned int size, i;
+    int status;
+
+    size = initScreen(&screen, width, height, bytesPerPixel, viewportMode, lowresPixelScaleFactor, pixels, &correctedPixels);
+    expected = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+
+    /* Garbage in the padding bytes, as they must be left untouched */
+    for(i = 0; i < size; i++)
+        expected[i] = correctedPixels[i] = (amiVideo_UByte)rand();
+
+    amiVideo_correctScreenPixels(&screen);
+
+    screen.correctedFormat.pixels = expected;
+    correctScreenPixels(&screen);
+
+    if(memcmp(expected, correctedPixels, size) == 0)
+        status = 0;
+    else
+    {
+        fprintf(stderr, "The corrected pixels of a %dx%d screen of %u bytes per pixel, viewport mode 0x%lx and scale factor %u are not identical!\n", width, height, bytesPerPixel, (unsigned long)viewportMode, lowresPixelScaleFactor);
+        status = 1;
+    }
+
+    free(expected);
+    free(correctedPixels);
+    free(pixels);
+    amiVideo_cleanupScreen(&screen);
+
+    return status;
+}
+
+/* Returns how many millions of corrected pixels per second the given correction produces */
+static double measureThroughput(amiVideo_Screen *screen, void (*correct)(amiVideo_Screen *screen))
+{
+    unsigned long numOfRuns = 0;
+    clock_t start = clock();
+    clock_t elapsed;
+
+    do
+    {
+        correct(screen);
+        numOfRuns++;
+        elapsed = clock() - start;
+    }
+    while(elapsed < CLOCKS_PER_SEC / 2);
+
+    return (double)numOfRuns * screen->correctedFormat.width * screen->correctedFormat.height * CLOCKS_PER_SEC / elapsed / 1000000.0;
+}
+
+static void benchmarkCorrection(const char *description, unsigned int bytesPerPixel, amiVideo_Long viewportMode, unsigned int lowresPixelScaleFactor)
+{
+    amiVideo_Screen screen;
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(640 * 512 * bytesPerPixel * sizeof(amiVideo_UByte));
+    amiVideo_UByte *correctedPixels;
+    double reference, optimised;
+
+    initScreen(&screen, 640, 512, bytesPerPixel, viewportMode, lowresPixelScaleFactor, pixels, &correctedPixels);
+
+    reference = measureThroughput(&screen, correctScreenPixels);
+    optimised = measureThroughput(&screen, amiVideo_correctScreenPixels);
+
+    printf("640x512 %s, %u byte(s) per pixel: %8.1f Mpixels/s pixel by pixel, %8.1f Mpixels/s optimised (%.1fx)\n", description, bytesPerPixel, reference, optimised, optimised / reference);
+
+    free(correctedPixels);
+    free(pixels);
+    amiVideo_cleanupScreen(&screen);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i;
+    int status = 0;
+
+    for(i = 0; i < NUM_OF_SIZES; i++)
+    {
+        unsigned int j;
+
+        for(j = 0; j < NUM_OF_VIEWPORT_MODES; j++)
+        {
+            unsigned int k;
+
+            for(k = 0; k < NUM_OF_SCALE_FACTORS; k++)
+            {
+                /* Super hires pixels require a scale factor of 4 and interlaced screens one of 2 */
+                if((amiVideo_checkSuperHires(viewportModes[j]) && scaleFactors[k] < 4) || (amiVideo_checkLaced(viewportModes[j]) && scaleFactors[k] < 2))
+                    continue;
+
+                status |= checkCorrection(sizes[i][0], sizes[i][1], 1, viewportModes[j], scaleFactors[k]);
+                status |= checkCorrection(sizes[i][0], sizes[i][1], 4, viewportModes[j], scaleFactors[k]);
+            }
+        }
+    }
+
+    if(argc > 1 && strcmp(argv[1], "benchmark") == 0)
+    {
+        unsigned int bytesPerPixel;
+
+        for(bytesPerPixel = 1; bytesPerPixel <= 4; bytesPerPixel += 3)
+        {
+            benchmarkCorrection("lowres x2", bytesPerPixel, 0, 2);
+            benchmarkCorrection("hires laced x2", bytesPerPixel, AMIVIDEO_VIDEOPORTMODE_HIRES | AMIVIDEO_VIDEOPORTMODE_LACE, 4);
+            benchmarkCorrection("lowres x4", bytesPerPixel, 0, 4);
+        }
+    }
+
+    return status;
+}
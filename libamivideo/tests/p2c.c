@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <screen.h>
+#include <viewportmode.h>
+
+#define NUM_OF_SIZES 10
+#define PADDING 3
+
+static const amiVideo_Word sizes[NUM_OF_SIZES][2] = {
+    { 1, 1 }, { 3, 5 }, { 8, 1 }, { 16, 2 }, { 17, 3 }, { 32, 20 }, { 33, 7 }, { 13, 11 }, { 320, 256 }, { 641, 3 }
+};
+
+/* The bit by bit conversion the optimised one must be identical to, into zeroed pixels */
+static void convertBitplanesToChunkyPixels(amiVideo_Screen *screen)
+{
+    unsigned int i;
+    
+    for(i = 0; i < screen->bitplaneDepth; i++)
+    {
+        unsigned int count = 0;
+        amiVideo_UByte indexBit = 1 << i;
+        amiVideo_UByte *bitplanes = screen->bitplaneFormat.bitplanes[i];
+        unsigned int vOffset = 0;
+        unsigned int j;
+        
+        for(j = 0; j < screen->height; j++)
+        {
+            unsigned int hOffset = vOffset;
+            unsigned int k;
+            unsigned int pixelCount = 0;
+            
+            for(k = 0; k < screen->bitplaneFormat.pitch; k++)
+            {
+                amiVideo_UByte bitplane = bitplanes[hOffset];
+                unsigned char bitmask = 0x80;
+                unsigned int l;
+                
+                for(l = 0; l < 8; l++)
+                {
+                    if(pixelCount < screen->width)
+                    {
+                        if(bitplane & bitmask)
+                            screen->uncorrectedChunkyFormat.pixels[count] |= indexBit;
+                        
+                        count++;
+                    }
+                    
+                    pixelCount++;
+                    bitmask >>= 1;
+                }
+                
+                hOffset++;
+            }
+            
+            count += screen->uncorrectedChunkyFormat.pitch - screen->width;
+            vOffset += screen->bitplaneFormat.pitch;
+        }
+    }
+}
+
+static int checkChunkyConversion(amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth)
+{
+    amiVideo_Screen screen;
+    unsigned int pitch = width + PADDING;
+    amiVideo_UByte *expected = (amiVideo_UByte*)malloc(pitch * height * sizeof(amiVideo_UByte));
+    amiVideo_UByte *pixels = (amiVideo_UByte*)malloc(pitch * height * sizeof(amiVideo_UByte));
+    amiVideo_UByte *bitplanes;
+    unsigned int size, i;
+    int status;
+    
+    amiVideo_initScreen(&screen, width, height, bitplaneDepth, 8, 0);
+    size = screen.bitplaneFormat.pitch * height * bitplaneDepth;
+    bitplanes = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    
+    /* The padding bits of the bitplanes must be ignored */
+    for(i = 0; i < size; i++)
+        bitplanes[i] = (amiVideo_UByte)rand();
+    
+    /* The pixels are overwritten, while the padding bytes are left untouched */
+    for(i = 0; i < pitch * height; i++)
+    {
+        pixels[i] = (amiVideo_UByte)rand();
+        expected[i] = i % pitch < width ? 0 : pixels[i];
+    }
+    
+    amiVideo_setScreenBitplanes(&screen, bitplanes);
+    
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, expected, pitch);
+    convertBitplanesToChunkyPixels(&screen);
+    
+    amiVideo_setScreenUncorrectedChunkyPixelsPointer(&screen, pixels, pitch);
+    amiVideo_convertScreenBitplanesToChunkyPixels(&screen);
+    
+    if(memcmp(expected, pixels, pitch * height) == 0)
+        status = 0;
+    else
+    {
+        fprintf(stderr, "The chunky pixels of a %dx%d screen of depth %u are not identical!\n", width, height, bitplaneDepth);
+        status = 1;
+    }
+    
+    free(bitplanes);
+    free(pixels);
+    free(expected);
+    amiVideo_cleanupScreen(&screen);
+    
+    return status;
+}
+
+static int checkRGBConversion(amiVideo_Word width, amiVideo_Word height, unsigned int bitplaneDepth, amiVideo_Long viewportMode)
+{
+    amiVideo_Screen screen, expectedScreen;
+    amiVideo_ULong *expected = (amiVideo_ULong*)malloc(width * height * sizeof(amiVideo_ULong));
+    amiVideo_ULong *pixels = (amiVideo_ULong*)malloc(width * height * sizeof(amiVideo_ULong));
+    amiVideo_Color colors[256];
+    amiVideo_UByte *bitplanes;
+    unsigned int size, i;
+    int status;
+    
+    amiVideo_initScreen(&screen, width, height, bitplaneDepth, 8, viewportMode);
+    amiVideo_initScreen(&expectedScreen, width, height, bitplaneDepth, 8, viewportMode);
+    size = screen.bitplaneFormat.pitch * height * bitplaneDepth;
+    bitplanes = (amiVideo_UByte*)malloc(size * sizeof(amiVideo_UByte));
+    
+    for(i = 0; i < size; i++)
+        bitplanes[i] = (amiVideo_UByte)rand();
+    
+    for(i = 0; i < 256; i++)
+    {
+        colors[i].r = (amiVideo_UByte)rand();
+        colors[i].g = (amiVideo_UByte)rand();
+        colors[i].b = (amiVideo_UByte)rand();
+    }
+    
+    amiVideo_setBitplanePaletteColors(&screen.palette, colors, screen.palette.bitplaneFormat.numOfColors);
+    amiVideo_setBitplanePaletteColors(&expectedScreen.palette, colors, expectedScreen.palette.bitplaneFormat.numOfColors);
+    
+    /* The expected pixels are converted to chunky pixels first, then to RGB pixels */
+    amiVideo_setScreenBitplanes(&expectedScreen, bitplanes);
+    amiVideo_setScreenUncorrectedRGBPixelsPointer(&expectedScreen, expected, width * 4, 1, 24, 16, 8, 0);
+    amiVideo_convertBitplaneColorsToChunkyFormat(&expectedScreen.palette);
+    convertBitplanesToChunkyPixels(&expectedScreen);
+    amiVideo_convertScreenChunkyPixelsToRGBPixels(&expectedScreen);
+    
+    amiVideo_setScreenBitplanes(&screen, bitplanes);
+    amiVideo_setScreenUncorrectedRGBPixelsPointer(&screen, pixels, width * 4, 1, 24, 16, 8, 0);
+    amiVideo_convertScreenBitplanesToRGBPixels(&screen);
+    
+    if(memcmp(expected, pixels, width * height * sizeof(amiVideo_ULong)) == 0 && memcmp(expectedScreen.uncorrectedChunkyFormat.pixels, screen.uncorrectedChunkyFormat.pixels, width * height) == 0)
+        status = 0;
+    else
+    {
+        fprintf(stderr, "The RGB pixels of a %dx%d screen of depth %u and mode %x are not identical!\n", width, height, bitplaneDepth, (unsigned int)viewportMode);
+        status = 1;
+    }
+    
+    free(bitplanes);
+    free(pixels);
+    free(expected);
+    amiVideo_cleanupScreen(&screen);
+    amiVideo_cleanupScreen(&expectedScreen);
+    
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int bitplaneDepth, i;
+    int status = 0;
+    
+    srand(0);
+    
+    for(bitplaneDepth = 1; bitplaneDepth <= 8; bitplaneDepth++)
+    {
+        for(i = 0; i < NUM_OF_SIZES; i++)
+        {
+            status |= checkChunkyConversion(sizes[i][0], sizes[i][1], bitplaneDepth);
+            status |= checkRGBConversion(sizes[i][0], sizes[i][1], bitplaneDepth, 0);
+        }
+    }
+    
+    for(i = 0; i < NUM_OF_SIZES; i++)
+    {
+        status |= checkRGBConversion(sizes[i][0], sizes[i][1], 6, AMIVIDEO_VIDEOPORTMODE_HAM);
+        status |= checkRGBConversion(sizes[i][0], sizes[i][1], 6, AMIVIDEO_VIDEOPORTMODE_EHB);
+    }
+    
+    return status;
+}
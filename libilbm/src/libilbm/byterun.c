@@ -104,28 +104,45 @@ PackMode;
 
 static int addRun(unsigned int equalCount, IFF_UByte *compressedChunkData, unsigned int count, IFF_UByte previousByte)
 {
-    char byte = 1 - equalCount;
-
-    compressedChunkData[count] = byte;
-    count++;
-    
-    compressedChunkData[count] = previousByte;
-    count++;
+    /* A run replicates at most 128 bytes, so longer ones are split */
+    while(equalCount > 0)
+    {
+	unsigned int length = equalCount > 128 ? 128 : equalCount;
+	
+	if(length == 1)
+	    compressedChunkData[count] = 0; /* A single remaining byte is taken literally */
+	else
+	    compressedChunkData[count] = (IFF_UByte)(257 - length);
+	
+	count++;
+	
+	compressedChunkData[count] = previousByte;
+	count++;
+	
+	equalCount -= length;
+    }
     
     return count;
 }
 
 static int addDump(unsigned int equalCount, IFF_UByte *compressedChunkData, unsigned int count, IFF_UByte *uncompressedChunkData, unsigned int readBytes)
 {
-    unsigned int i;
+    unsigned int i = readBytes - equalCount;
     
-    compressedChunkData[count] = equalCount - 1;
-    count++;
-
-    for(i = readBytes - equalCount; i < readBytes; i++)
+    /* A dump takes at most 128 bytes literally, so longer ones are split */
+    while(i < readBytes)
     {
-	compressedChunkData[count] = uncompressedChunkData[i];
+	unsigned int length = readBytes - i > 128 ? 128 : readBytes - i;
+	unsigned int end = i + length;
+	
+	compressedChunkData[count] = length - 1;
 	count++;
+	
+	for(; i < end; i++)
+	{
+	    compressedChunkData[count] = uncompressedChunkData[i];
+	    count++;
+	}
     }
 
     return count;
@@ -228,6 +245,11 @@ static int packRow(IFF_UByte *uncompressedChunkData, IFF_UByte *compressedChunkD
     return count;
 }
 
+unsigned int ILBM_packByteRunRow(IFF_UByte *uncompressedData, IFF_UByte *compressedData, const unsigned int uncompressedOffset, const unsigned int compressedOffset, const unsigned int rowSize)
+{
+    return packRow(uncompressedData, compressedData, uncompressedOffset, compressedOffset, rowSize);
+}
+
 void ILBM_packByteRun(ILBM_Image *image)
 {
     IFF_RawChunk *body = image->body;
@@ -31,6 +31,8 @@ void ILBM_unpackByteRun(ILBM_Image *image);
 
 void ILBM_packByteRun(ILBM_Image *image);
 
+unsigned int ILBM_packByteRunRow(IFF_UByte *uncompressedData, IFF_UByte *compressedData, const unsigned int uncompressedOffset, const unsigned int compressedOffset, const unsigned int rowSize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2012 Sander van der Burg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ilbmwriter.h"
+#include <stdlib.h>
+#include <libiff/id.h>
+#include <libiff/io.h>
+#include <libiff/error.h>
+#include "ilbm.h"
+#include "byterun.h"
+
+static void freeWriter(ILBM_Writer *writer)
+{
+    free(writer->compressedScanLine);
+    free(writer);
+}
+
+static ILBM_Writer *openWriter(const char *filename, const ILBM_Image *image, IFF_Form *form)
+{
+    ILBM_Writer *writer;
+    int status;
+    
+    if(image->bitMapHeader == NULL || image->body != NULL || image->bitplanes != NULL)
+    {
+        IFF_error("The image to write must have a bitmap header and no body!\n");
+        return NULL;
+    }
+    
+    if(image->bitMapHeader->compression != ILBM_CMP_NONE && image->bitMapHeader->compression != ILBM_CMP_BYTE_RUN)
+    {
+        IFF_error("Unknown compression of the body!\n");
+        return NULL;
+    }
+    
+    writer = (ILBM_Writer*)malloc(sizeof(ILBM_Writer));
+    
+    if(writer == NULL)
+        return NULL;
+    
+    /* A scan line has a row for each bitplane, followed by a row for the mask if there is one */
+    writer->rowSize = ILBM_calculateRowSize(image);
+    writer->numOfRows = image->bitMapHeader->nPlanes + (image->bitMapHeader->masking == ILBM_MSK_HAS_MASK ? 1 : 0);
+    writer->compression = image->bitMapHeader->compression;
+    writer->height = image->bitMapHeader->h;
+    writer->numOfScanLines = 0;
+    writer->bodySize = 0;
+    
+    /* A packed row may be up to twice as large as the row itself */
+    if(writer->compression == ILBM_CMP_BYTE_RUN)
+    {
+        writer->compressedScanLine = (IFF_UByte*)malloc(2 * writer->rowSize * writer->numOfRows * sizeof(IFF_UByte));
+        
+        if(writer->compressedScanLine == NULL)
+        {
+            free(writer);
+            return NULL;
+        }
+    }
+    else
+        writer->compressedScanLine = NULL;
+    
+    writer->file = fopen(filename, "wb");
+    
+    if(writer->file == NULL)
+    {
+        IFF_error("ERROR: cannot open file: %s\n", filename);
+        freeWriter(writer);
+        return NULL;
+    }
+    
+    /* Write the form with all the chunks of the image, and the header of the body */
+    writer->formPosition = ftell(writer->file);
+    writer->formSize = form->chunkSize;
+    
+    status = ILBM_writeFd(writer->file, (IFF_Chunk*)form) && IFF_writeId(writer->file, "BODY", "BODY", "chunkId");
+    writer->bodyPosition = ftell(writer->file);
+    status = status && IFF_writeLong(writer->file, 0, "BODY", "chunkSize");
+    
+    if(!status || writer->formPosition < 0 || writer->bodyPosition < 0)
+    {
+        fclose(writer->file);
+        freeWriter(writer);
+        return NULL;
+    }
+    
+    return writer;
+}
+
+ILBM_Writer *ILBM_openWriter(const char *filename, ILBM_Image *image)
+{
+    /* The form takes the chunks of the image, which are freed with it whether the writer could be opened or not */
+    IFF_Form *form = ILBM_convertImageToForm(image);
+    ILBM_Writer *writer = openWriter(filename, image, form);
+    
+    ILBM_free((IFF_Chunk*)form);
+    return writer;
+}
+
+int ILBM_writeScanLine(ILBM_Writer *writer, IFF_UByte *scanLine)
+{
+    IFF_UByte *data = scanLine;
+    unsigned int size = writer->rowSize * writer->numOfRows;
+    
+    if(writer->numOfScanLines == writer->height)
+    {
+        IFF_error("All the scan lines of the body have already been written!\n");
+        return FALSE;
+    }
+    
+    /* Each row is packed separately */
+    if(writer->compression == ILBM_CMP_BYTE_RUN)
+    {
+        unsigned int i;
+        unsigned int count = 0;
+        
+        for(i = 0; i < writer->numOfRows; i++)
+            count = ILBM_packByteRunRow(scanLine, writer->compressedScanLine, i * writer->rowSize, count, writer->rowSize);
+        
+        data = writer->compressedScanLine;
+        size = count;
+    }
+    
+    if(fwrite(data, sizeof(IFF_UByte), size, writer->file) != size)
+    {
+        IFF_error("Cannot write scan line of 'BODY'\n");
+        return FALSE;
+    }
+    
+    writer->bodySize += size;
+    writer->numOfScanLines++;
+    
+    return TRUE;
+}
+
+int ILBM_closeWriter(ILBM_Writer *writer)
+{
+    int status = TRUE;
+    
+    if(writer->numOfScanLines != writer->height)
+    {
+        IFF_error("The body has %u scan lines, while the image has %u!\n", writer->numOfScanLines, writer->height);
+        status = FALSE;
+    }
+    
+    /* The form grows with the body chunk and its padding byte */
+    status = status && IFF_writePaddingByte(writer->file, writer->bodySize, "BODY");
+    writer->formSize += IFF_ID_SIZE + sizeof(IFF_Long) + writer->bodySize + writer->bodySize % 2;
+    
+    status = status && fseek(writer->file, writer->formPosition + IFF_ID_SIZE, SEEK_SET) == 0
+        && IFF_writeLong(writer->file, writer->formSize, "FORM", "chunkSize")
+        && fseek(writer->file, writer->bodyPosition, SEEK_SET) == 0
+        && IFF_writeLong(writer->file, writer->bodySize, "BODY", "chunkSize");
+    
+    if(fclose(writer->file) != 0)
+        status = FALSE;
+    
+    freeWriter(writer);
+    
+    return status;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2012 Sander van der Burg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ILBM_ILBMWRITER_H
+#define __ILBM_ILBMWRITER_H
+
+#include <stdio.h>
+#include <libiff/ifftypes.h>
+#include "ilbmimage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Writes an ILBM file one scan line at a time. The chunks of the image are
+ * written when the writer is opened, then the body is appended scan line by
+ * scan line, packed if the bitmap header asks for it. The sizes of the BODY
+ * and FORM chunks are written back when the writer is closed.
+ */
+typedef struct
+{
+    FILE *file;
+    
+    unsigned int rowSize;
+    unsigned int numOfRows;
+    IFF_UByte compression;
+    IFF_UByte *compressedScanLine;
+    
+    unsigned int height;
+    unsigned int numOfScanLines;
+    
+    long formPosition;
+    IFF_Long formSize;
+    long bodyPosition;
+    IFF_Long bodySize;
+}
+ILBM_Writer;
+
+/*
+ * Opens a writer of the given image, which must have a bitmap header and no
+ * body. The chunks of the image are always freed, even when the writer cannot
+ * be opened, so only ILBM_freeImage() remains to be called on the image.
+ * Returns NULL on failure.
+ */
+ILBM_Writer *ILBM_openWriter(const char *filename, ILBM_Image *image);
+
+int ILBM_writeScanLine(ILBM_Writer *writer, IFF_UByte *scanLine);
+
+int ILBM_closeWriter(ILBM_Writer *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
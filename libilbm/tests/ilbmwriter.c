@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2012 Sander van der Burg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so, 
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "ilbm.h"
+#include "ilbmimage.h"
+#include "ilbmwriter.h"
+#include "byterun.h"
+
+#define WIDTH 1500
+#define HEIGHT 40
+#define NUM_OF_PLANES 5
+
+/* Creates the interleaved scan lines of a body with runs and rows longer than 128 bytes */
+static IFF_UByte *createBody(unsigned int rowSize)
+{
+    unsigned int size = rowSize * NUM_OF_PLANES * HEIGHT;
+    IFF_UByte *body = (IFF_UByte*)malloc(size * sizeof(IFF_UByte));
+    unsigned int i;
+    
+    for(i = 0; i < size; i++)
+    {
+        unsigned int row = i / rowSize;
+        
+        if(row % 3 == 0)
+            body[i] = (IFF_UByte)rand(); /* Literal bytes */
+        else if(row % 3 == 1)
+            body[i] = (IFF_UByte)(i % rowSize / 200); /* Long runs */
+        else
+            body[i] = (IFF_UByte)(rand() % 4 == 0 ? rand() : 0x55); /* Short runs and literal bytes */
+    }
+    
+    return body;
+}
+
+static ILBM_Image *createImage(IFF_UByte compression)
+{
+    ILBM_Image *image = ILBM_createImage("ILBM");
+    ILBM_BitMapHeader *bitMapHeader = ILBM_createBitMapHeader();
+    ILBM_ColorMap *colorMap = ILBM_createColorMap();
+    unsigned int i;
+    
+    bitMapHeader->w = WIDTH;
+    bitMapHeader->h = HEIGHT;
+    bitMapHeader->x = 0;
+    bitMapHeader->y = 0;
+    bitMapHeader->nPlanes = NUM_OF_PLANES;
+    bitMapHeader->masking = ILBM_MSK_NONE;
+    bitMapHeader->compression = compression;
+    bitMapHeader->transparentColor = 0;
+    bitMapHeader->xAspect = 11;
+    bitMapHeader->yAspect = 10;
+    bitMapHeader->pageWidth = WIDTH;
+    bitMapHeader->pageHeight = HEIGHT;
+    image->bitMapHeader = bitMapHeader;
+    
+    for(i = 0; i < (1 << NUM_OF_PLANES); i++)
+    {
+        ILBM_ColorRegister *colorRegister = ILBM_addColorRegisterInColorMap(colorMap);
+        colorRegister->red = i * 8;
+        colorRegister->green = 255 - i * 8;
+        colorRegister->blue = i * 4;
+    }
+    image->colorMap = colorMap;
+    
+    return image;
+}
+
+static int checkWriter(const char *filename, IFF_UByte compression)
+{
+    ILBM_Image *image = createImage(compression);
+    unsigned int rowSize = ILBM_calculateRowSize(image);
+    unsigned int scanLineSize = rowSize * NUM_OF_PLANES;
+    IFF_UByte *body = createBody(rowSize);
+    ILBM_Writer *writer = ILBM_openWriter(filename, image);
+    IFF_Chunk *chunk;
+    ILBM_Image **images;
+    unsigned int imagesLength;
+    unsigned int i;
+    int status = 0;
+    
+    ILBM_freeImage(image);
+    
+    if(writer == NULL)
+    {
+        fprintf(stderr, "Cannot open the writer of %s\n", filename);
+        free(body);
+        return 1;
+    }
+    
+    for(i = 0; i < HEIGHT; i++)
+    {
+        if(!ILBM_writeScanLine(writer, body + i * scanLineSize))
+            status = 1;
+    }
+    
+    if(!ILBM_closeWriter(writer) || status != 0)
+    {
+        fprintf(stderr, "Error writing %s\n", filename);
+        free(body);
+        return 1;
+    }
+    
+    /* Read the file back and compare its uncompressed body */
+    chunk = ILBM_read(filename);
+    
+    if(chunk == NULL || !ILBM_check(chunk))
+    {
+        fprintf(stderr, "%s is not a valid ILBM file\n", filename);
+        free(body);
+        return 1;
+    }
+    
+    images = ILBM_extractImages(chunk, &imagesLength);
+    
+    if(imagesLength != 1 || images[0]->body == NULL || images[0]->bitMapHeader->compression != compression)
+    {
+        fprintf(stderr, "%s does not have the written image\n", filename);
+        status = 1;
+    }
+    else
+    {
+        ILBM_unpackByteRun(images[0]);
+        
+        if(images[0]->body->chunkSize != scanLineSize * HEIGHT || memcmp(images[0]->body->chunkData, body, scanLineSize * HEIGHT) != 0)
+        {
+            fprintf(stderr, "The body of %s is not the written one!\n", filename);
+            status = 1;
+        }
+    }
+    
+    ILBM_freeImages(images, imagesLength);
+    ILBM_free(chunk);
+    free(body);
+    
+    return status;
+}
+
+/* The chunks of the image are freed even when the writer cannot be opened */
+static int checkFailure(const char *filename, ILBM_Image *image)
+{
+    ILBM_Writer *writer = ILBM_openWriter(filename, image);
+    
+    ILBM_freeImage(image);
+    
+    if(writer != NULL)
+    {
+        fprintf(stderr, "A writer of %s is opened!\n", filename);
+        ILBM_closeWriter(writer);
+        return 1;
+    }
+    
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    ILBM_Image *image;
+    int status = 0;
+    
+    srand(0);
+    
+    status |= checkWriter("writer.ILBM", ILBM_CMP_NONE);
+    status |= checkWriter("writer-byterun.ILBM", ILBM_CMP_BYTE_RUN);
+    status |= checkFailure("nonexistent/writer.ILBM", createImage(ILBM_CMP_BYTE_RUN));
+    
+    image = ILBM_createImage("ILBM");
+    image->colorMap = ILBM_createColorMap();
+    status |= checkFailure("writer-noheader.ILBM", image);
+    
+    return status;
+}